@@ -8,34 +8,40 @@
 // The main allocator works in runs of pages.
 // Small allocation sizes (up to and including 32 kB) are
 // rounded to one of about 100 size classes, each of which
-// has its own free list of objects of exactly that size.
+// has its own set of spans holding objects of exactly that size.
 // Any free page of memory can be split into a set of objects
-// of one size class, which are then managed using free list
-// allocators.
+// of one size class, which are then managed using a per-span
+// allocation bitmap.
 //
 // The allocator's data structures are:
 //
-//	FixAlloc: a free-list allocator for fixed-size objects,
+//	SlabAlloc: a slab allocator for fixed-size objects,
 //		used to manage storage used by the allocator.
 //	MHeap: the malloc heap, managed at page (4096-byte) granularity.
 //	MSpan: a run of pages managed by the MHeap.
-//	MCentral: a shared free list for a given size class.
+//	MCentral: a shared set of spans for a given span class.
 //	MCache: a per-thread (in Go, per-M) cache for small objects.
 //	MStats: allocation statistics.
+//	MAllocStats: allocator statistics not exported to Go.
 //
 // Allocating a small object proceeds up a hierarchy of caches:
 //
 //	1. Round the size up to one of the small size classes
-//	   and look in the corresponding MCache free list.
-//	   If the list is not empty, allocate an object from it.
+//	   and look at the span the MCache holds for that class
+//	   and for objects with or without pointers (the span
+//	   class; pointer-free objects get spans of their own,
+//	   which the collector never scans).
+//	   Scan the span's allocation bitmap forward from its
+//	   free index; if a free slot is found, allocate it.
 //	   This can all be done without acquiring a lock.
 //
-//	2. If the MCache free list is empty, replenish it by
-//	   taking a bunch of objects from the MCentral free list.
-//	   Moving a bunch amortizes the cost of acquiring the MCentral lock.
+//	2. If the MCache span has no free slots left, return it to
+//	   the MCentral and take another span with free slots.
+//	   The MCentral keeps those spans on a lock-free stack,
+//	   so refills from many threads do not serialize.
 //
-//	3. If the MCentral free list is empty, replenish it by
-//	   allocating a run of pages from the MHeap and then
+//	3. If the MCentral has no span with free slots, replenish it
+//	   by allocating a run of pages from the MHeap and then
 //	   chopping that memory into a objects of the given size.
 //	   Allocating many objects amortizes the cost of locking
 //	   the heap.
@@ -45,34 +51,48 @@
 //	   operating system.  Allocating a large run of pages
 //	   amortizes the cost of talking to the operating system.
 //
-// Freeing a small object proceeds up the same hierarchy:
+// Small objects are freed by the garbage collector's sweep:
 //
-//	1. Look up the size class for the object and add it to
-//	   the MCache free list.
+//	1. The sweeper builds a new allocation bitmap for the span
+//	   from the mark bits, swaps it in, and rewinds the span's
+//	   free index.  The free objects themselves are not touched.
 //
-//	2. If the MCache free list is too long or the MCache has
-//	   too much memory, return some to the MCentral free lists.
+//	2. If all the objects in a given span are free, the span
+//	   is returned to the page heap.
 //
-//	3. If all the objects in a given span have returned to
-//	   the MCentral list, return that span to the page heap.
+//	3. If the heap has too much memory, return some to the
+//	   operating system.  The scavenger goroutine (see mheap.c)
+//	   releases idle spans, largest first, whenever the memory
+//	   retained from the operating system exceeds its goal, and
+//	   also releases spans that have been idle for a long time.
 //
-//	4. If the heap has too much memory, return some to the
-//	   operating system.
+// An explicit runtime·free of a small object only clears its
+// heap bitmap bits; the slot becomes allocatable again at the
+// next sweep.
 //
-//	TODO(rsc): Step 4 is not implemented.
+// A Region (see mregion.c) hands out objects from chunks of pages
+// with a bump pointer and frees them all in one call; the heap
+// bitmap and the sweeper see only the chunks.
+//
+// runtime·growalloc grows a block in place when it can: a small
+// object up to its size class, a large object by taking the free
+// pages that follow it in the heap.
 //
 // Allocating and freeing a large object uses the page heap
-// directly, bypassing the MCache and MCentral free lists.
+// directly, bypassing the MCache and MCentral.  Objects of
+// up to MaxPageCacheSize bytes are carved instead from a chunk
+// of pages that the MCache takes from the heap PageCacheChunk
+// bytes at a time, so only every few of them lock the heap.
+// The rest of the chunk goes back to the heap at each GC.
 //
-// The small objects on the MCache and MCentral free lists
-// may or may not be zeroed.  They are zeroed if and only if
-// the second word of the object is zero.  The spans in the
+// Free slots in a span may or may not be zeroed.  They are
+// zeroed if the span's needzero flag is clear.  The spans in the
 // page heap are always zeroed.  When a span full of objects
 // is returned to the page heap, the objects that need to be
 // are zeroed first.  There are two main benefits to delaying the
 // zeroing this way:
 //
-//	1. stack frames allocated from the small object lists
+//	1. stack frames allocated from the small object spans
 //	   can avoid zeroing altogether.
 //	2. the cost of zeroing when reusing a small object is
 //	   charged to the mutator, not the garbage collector.
@@ -82,7 +102,7 @@
 /* goڴǻtcmalloc.Լ100ڴ,ÿһԼfree list.С32kBڴ䱻ȡӦĴС,Ӧfree listз.һҳڴԱѳһִСĶ,Ȼfree list.
 
    ݽṹ:
-   + FixAlloc: ̶С(128kB)ĶĿ,ڹ洢
+   + SlabAlloc: ̶Сslab(ÿslab 64kB,slabԻϵͳ),ڹ洢
    + MHeap: ,ҳȽй(4kB)
    + MSpan: һЩMHeapҳ
    + MCentral: ڸСĹfree list
@@ -108,9 +128,17 @@
 
 typedef struct MCentral	MCentral;
 typedef struct MHeap	MHeap;
+typedef struct MHeapArena	MHeapArena;
 typedef struct MSpan	MSpan;
 typedef struct MStats	MStats;
+typedef struct MAllocStats	MAllocStats;
 typedef struct MLink	MLink;
+typedef struct Slab	Slab;
+typedef struct SlabAlloc	SlabAlloc;
+typedef struct SizeClassTable	SizeClassTable;
+typedef struct Region	Region;
+typedef struct Pool	Pool;
+typedef struct MTypes	MTypes;
 
 enum
 {
@@ -120,6 +148,14 @@ enum
 };
 typedef	uintptr	PageID;		// address >> PageShift
 
+// A span class is a size class and a noscan bit.  Spans of a noscan
+// class hold only pointer-free objects, so the collector marks their
+// objects without scanning them and never needs per-object
+// pointer information for them.
+#define SpanClass(sizeclass, noscan)	(((sizeclass)<<1) | ((noscan) != 0))
+#define SpanClass_SizeClass(spc)	((spc)>>1)
+#define SpanClass_NoScan(spc)	((spc)&1)
+
 enum
 {
 	// Computed constant.  The definition of MaxSmallSize and the
@@ -129,29 +165,71 @@ enum
 	// size choosing algorithm it double-checks that NumSizeClasses agrees.
 	NumSizeClasses = 61,
 
+	// Each size class has two span classes, one for objects
+	// with pointers and one for pointer-free (noscan) objects
+	// (see SpanClass).
+	NumSpanClasses = NumSizeClasses<<1,
+
 	// Tunable constants.
 	MaxSmallSize = 32<<10,
 
+	// Pointer-free objects smaller than TinySize are combined
+	// into TinySize blocks of size class TinySizeClass
+	// (see mallocgc).
+	TinySize = 16,
+	TinySizeClass = 2,
+
+	// Allocations larger than MaxSmallSize but no larger than
+	// MaxPageCacheSize are carved from a per-MCache chunk of
+	// PageCacheChunk bytes of pages (see MCache_AllocLarge).
+	MaxPageCacheSize = 256<<10,
+	PageCacheChunk = 1<<20,
+	PageCacheSpans = 32,	// MSpan structures kept for carving
+
 	FixAllocChunk = 128<<10,	// FixAllocChunkС128K
+	SlabSize = 64<<10,		// SlabAlloc slab size, also its alignment
+	NumLocalPools = 16,		// pools with slots in each MCache
+	PoolLocalSize = 8,		// slots per pool per MCache
 	MaxMCacheListLen = 256,		// MCache󳤶256
 	MaxMCacheSize = 2<<20,		// MCacheС2M
+	MaxGrowSpans = 16,		// most spans an MCache refill takes from the heap at once
 	MaxMHeapList = 1<<(20 - PageShift),	// MHeapеĹ̶СҳҲ256
-	HeapAllocChunk = 1<<20,		// Chunk size for heap growth
+	HeapAllocChunk = 1<<20,		// Minimum chunk size for heap growth
+	MaxHeapAllocChunk = 64<<20,	// Maximum chunk size for heap growth
 
-	// Number of bits in page to span calculations (4k pages).
-	// On 64-bit, we limit the arena to 16G, so 22 bits suffices.
-	// On 32-bit, we don't bother limiting anything: 20 bits for 4G.
+	// Transparent huge pages, used if runtime·hugepages is set.
+	HugePageShift = 21,
+	HugePageSize = 1<<HugePageShift,
+	HugePagePages = HugePageSize>>PageShift,
+
+	// Heap arenas (see MHeapArena).  On 64-bit, the 48-bit address
+	// space is 2^10 first-level index entries of 2^12 64 MB arenas.
+	// On 32-bit, one first-level entry covers 2^10 4 MB arenas.
 #ifdef _64BIT
-	MHeapMap_Bits = 22,
+	HeapAddrBits = 48,
+	HeapArenaShift = 26,
+	ArenaL2Bits = 12,
 #else
-	MHeapMap_Bits = 20,
+	HeapAddrBits = 32,
+	HeapArenaShift = 22,
+	ArenaL2Bits = 10,
 #endif
+	ArenaL1Bits = HeapAddrBits - HeapArenaShift - ArenaL2Bits,
+	HeapArenaBytes = 1<<HeapArenaShift,
+	PagesPerArena = HeapArenaBytes>>PageShift,
+	HeapArenaBitmapBytes = HeapArenaBytes/(sizeof(void*)*8/4),	// 4 bits per word
 
 	// Max number of threads to run garbage collection.
 	// 2, 3, and 4 are all plausible maximums depending
 	// on the hardware details of the machine.  The garbage
 	// collector scales well to 4 cpus.
 	MaxGcproc = 4,
+
+	// Maximum number of objects in a small-object span.  The
+	// smallest size class is 8 bytes in a single page, so every
+	// span's allocation bitmap fits in MaxSpanObjects bits.
+	// MCentral_Init checks this against the size class table.
+	MaxSpanObjects = PageSize/8,
 };
 
 // A generic linked list of blocks.  (Typically the block is bigger than sizeof(MLink).)
@@ -171,7 +249,19 @@ struct MLink
 // SysUnused notifies the operating system that the contents
 // of the memory region are no longer needed and can be reused
 // for other purposes.  The program reserves the right to start
-// accessing those pages in the future.
+// accessing those pages in the future.  If runtime·sysunusedlazy
+// is set, the operating system may take the pages back lazily,
+// only under memory pressure (MADV_FREE instead of MADV_DONTNEED
+// on Linux): reuse is cheaper, but RSS does not drop right away.
+//
+// SysUsed notifies the operating system that a region passed to
+// SysUnused is about to be used again.
+//
+// If runtime·hugepages is set, SysMap and SysUsed ask for the
+// region to be backed by transparent huge pages and SysUnused
+// asks for it not to be, so that the kernel does not collapse
+// released memory back into huge pages.  The heap passes them
+// whole huge pages where it can (see MHeap_Grow, scavengespan).
 //
 // SysFree returns it unconditionally; this is only used if
 // an out-of-memory error has been detected midway through
@@ -187,12 +277,15 @@ struct MLink
 void*	runtime·SysAlloc(uintptr nbytes);/*伸K1M*/
 void	runtime·SysFree(void *v, uintptr nbytes);
 void	runtime·SysUnused(void *v, uintptr nbytes);
+void	runtime·SysUsed(void *v, uintptr nbytes);
 void	runtime·SysMap(void *v, uintptr nbytes);
 void*	runtime·SysReserve(void *v, uintptr nbytes);
+extern	int32	runtime·sysunusedlazy;
+extern	int32	runtime·hugepages;
 
 // FixAlloc is a simple free-list allocator for fixed size objects.
-// Malloc uses a FixAlloc wrapped around SysAlloc to manages its
-// MCache and MSpan objects.
+// The scheduler uses a FixAlloc wrapped around SysAlloc to manage
+// its stacks.
 //
 // Memory returned by FixAlloc_Alloc is not zeroed.
 // The caller is responsible for locking around FixAlloc calls.
@@ -215,6 +308,63 @@ void	runtime·FixAlloc_Init(FixAlloc *f, uintptr size, void *(*alloc)(uintptr),
 void*	runtime·FixAlloc_Alloc(FixAlloc *f);
 void	runtime·FixAlloc_Free(FixAlloc *f, void *p);
 
+// SlabAlloc is a slab allocator for fixed size objects.
+// Malloc uses it to manage its MCache and MSpan objects.
+//
+// Objects come from SlabSize slabs mapped directly from the
+// operating system, and a slab whose objects are all free can be
+// given back with SlabAlloc_Release.
+//
+// Memory returned by SlabAlloc_Alloc is not zeroed.
+// Callers can keep state in the object but the first word is
+// smashed by freeing and reallocating.
+struct Slab
+{
+	Slab *next;	// in a SlabAlloc list
+	Slab *prev;
+	MLink *free;	// freed objects
+	byte *fresh;	// objects from here on have never been handed out
+	uint32 nfree;	// free objects, including fresh ones
+	uint32 nobj;
+};
+
+struct SlabAlloc
+{
+	Lock;
+	uintptr size;
+	void (*first)(void *arg, byte *p);	// called first time p is handed out
+	void (*release)(void *arg, byte *lo, byte *hi);	// called before a slab is freed
+	void *arg;
+	Slab partial;	// slabs with some objects free
+	Slab full;	// slabs with no objects free
+	Slab empty;	// slabs with all objects free
+	uint32 nempty;
+	uint64 inuse;	// bytes handed out and not freed (updated atomically)
+	uintptr sys;	// bytes in slabs
+};
+
+void	runtime·SlabAlloc_Init(SlabAlloc *f, uintptr size, void (*first)(void*, byte*), void (*release)(void*, byte*, byte*), void *arg);
+void*	runtime·SlabAlloc_Alloc(SlabAlloc *f);
+void	runtime·SlabAlloc_Free(SlabAlloc *f, void *p);
+uintptr	runtime·SlabAlloc_Release(SlabAlloc *f, uint32 keep);
+
+
+// Tiers of the allocation slow path, for the latency histograms
+// in MAllocStats.alloclatency.  The time of a tier includes that of the
+// tiers it calls.
+enum
+{
+	AllocTierCache,	// MCache refill: a cached span or page chunk ran out
+	AllocTierCentral,	// MCentral_Grow: no span in the MCentral had room
+	AllocTierHeap,	// MHeap_Alloc and friends: lock the heap, find free pages
+	AllocTierGrow,	// MHeap_Grow: map more memory for the heap
+	AllocTierGC,	// collection triggered by an allocation
+	NumAllocTiers,
+
+	// Bucket i counts durations of [2^i, 2^(i+1)) nanoseconds;
+	// the last bucket also counts anything longer.
+	NumLatencyBuckets = 32,
+};
 
 // Statistics.
 // Shared with Go: if you edit this structure, also edit extern.go.
@@ -238,7 +388,7 @@ struct MStats
 	uint64	heap_objects;	// total number of allocated objects
 
 	// Statistics about allocation of low-level fixed-size structures.
-	// Protected by FixAlloc locks.
+	// Protected by FixAlloc locks or the heap lock.
 	uint64	stacks_inuse;	// bootstrap stacks
 	uint64	stacks_sys;
 	uint64	mspan_inuse;	// MSpan structures
@@ -268,8 +418,39 @@ struct MStats
 #define mstats runtime·memStats	/* name shared with Go */
 extern MStats mstats;
 
+// Statistics that only the runtime reads.  They are kept out of
+// MStats so that its layout still matches runtime.MemStats.
+// Purged from the MCaches along with mstats and protected the
+// same way.
+struct MAllocStats
+{
+	// Statistics about heap growth.
+	uint64	heap_grow;	// times the heap grew (see MHeap_Grow)
+	uint64	heap_grow_ns;	// time spent growing it
+	uint64	heap_growchunk;	// current growth step
+
+	// Statistics about the MCache page caches.
+	uint64	pagecache_hit;	// multi-page allocations served from a page cache
+	uint64	pagecache_miss;	// multi-page allocations that refilled a page cache
+	uint64	mcache_held;	// bytes of free objects and pages held in MCaches
+
+	// Statistics about MCache refills, per size class.
+	struct {
+		uint64 nrefill;	// MCache refills from the MCentral
+		uint64 ngrow;	// refills that had to take new spans from the heap
+	} by_size[NumSizeClasses];
+
+	// Time spent in each tier of the allocation slow path,
+	// as log2 histograms (see AllocTierCache).
+	uint64	alloclatency[NumAllocTiers][NumLatencyBuckets];
+};
+
+extern MAllocStats runtime·allocstats;
+void	runtime·ReadAllocStats(MAllocStats *stats);
 
-// Size classes.  Computed and initialized by InitSizes.
+
+// Size classes.  Computed and initialized by InitSizes,
+// or loaded from runtime·sizeclasses by LoadSizeClasses.
 //
 // SizeToClass(0 <= n <= MaxSmallSize) returns the size class,
 //	1 <= sizeclass < NumSizeClasses, for n.
@@ -287,22 +468,88 @@ extern	int32	runtime·class_to_size[NumSizeClasses];
 extern	int32	runtime·class_to_allocnpages[NumSizeClasses];
 extern	int32	runtime·class_to_transfercount[NumSizeClasses];
 extern	void	runtime·InitSizes(void);
+void	runtime·DefaultSizeClasses(SizeClassTable *t);
+
+// class_to_divmul[i] = ceil(2^32 / class_to_size[i]), 0 for class 0.
+//	Multiplying an offset into a span of class i by it and
+//	shifting right by 32 divides the offset by the size,
+//	exactly for every offset below the span's limit, which
+//	mallocinit checks.  Spares the mark path a division.
+extern	uint32	runtime·class_to_divmul[NumSizeClasses];
+
+// Index of the object at byte offset off of small-object span s,
+// which must be below s->limit: off / s->elemsize.
+#define MSpan_ObjIndex(s, off)	((uintptr)(((uint64)(uint32)(off) * (s)->divmul) >> 32))
+
+// SizeToClass(n) looks n up in size_to_class8[(n+7)>>3] if
+// n <= 1024-8, otherwise in size_to_class128[(n-1024+127)>>7].
+extern	int32	runtime·size_to_class8[1024/8 + 1];
+extern	int32	runtime·size_to_class128[(MaxSmallSize-1024)/128 + 1];
+
+// A size class table tuned to a workload (see msizetune.c).
+// If runtime·sizeclasses has nclass set, mallocinit loads it
+// in place of the table InitSizes computes.
+struct SizeClassTable
+{
+	int32	nclass;
+	int32	size[NumSizeClasses];
+	int32	npages[NumSizeClasses];
+	int32	transfer[NumSizeClasses];
+};
+
+// Histogram buckets of small allocation sizes, one per entry of
+// the SizeToClass lookup tables.
+enum
+{
+	NumSizeBuckets = 1024/8 + 1 + (MaxSmallSize-1024)/128,
+};
+#define SizeBucket(n)	((n) <= 1024 ? ((n)+7)>>3 : 1024/8 + (((n)-1024+127)>>7))
+
+extern	SizeClassTable	runtime·sizeclasses;
+extern	uint64	runtime·sizehist[NumSizeBuckets];
+void	runtime·GenSizeClasses(uint64 *hist, SizeClassTable *t);
+void	runtime·LoadSizeClasses(SizeClassTable *t);
 
 
 // Per-thread (in Go, per-M) cache for small objects.
 // No locking needed because it is per-thread (per-M).
+// Each span class owns at most one span at a time; objects are
+// handed out by scanning that span's allocation bitmap.
 typedef struct MCacheList MCacheList;
+typedef struct MCachePool MCachePool;
 struct MCacheList
 {
-	MLink *list;
-	uint32 nlist;
-	uint32 nlistmin;
+	MSpan *span;	// span to allocate from, or nil
+
+	// Use of the list as of the last trim pass (see MCache_Trim).
+	MSpan *trimspan;	// span
+	uint32 trimfree;	// and its freeindex
+	uint32 idle;	// trim passes since the list was last used
+};
+
+// An MCache's slots for one Pool (see runtime·PoolGet).
+struct MCachePool
+{
+	uint32 n;
+	void *obj[PoolLocalSize];
 };
 
 struct MCache
 {
-	MCacheList list[NumSizeClasses];
-	uint64 size;
+	MCacheList list[NumSpanClasses];
+	uint64 size;	// bytes in free slots of cached spans
+	byte *tiny;	// free space in the current tiny block
+	uintptr tinysize;	// bytes left in the current tiny block
+
+	// The local_* counters below are written only by the M that
+	// owns the cache, which makes statsseq odd while it updates them
+	// (MCache_BeginStats) and even again after (MCache_EndStats).
+	// runtime·ReadMemStats reads them without stopping the world and
+	// retries while statsseq is odd or has changed, as with a
+	// sequence lock.  purgecachedstats and the sweeper change them
+	// without bumping statsseq: they run with the heap locked or the
+	// world stopped, which excludes ReadMemStats.
+	uint32 statsseq;
 	int64 local_cachealloc;	// bytes allocated (or freed) from cache since last lock of heap
 	int64 local_objects;	// objects allocated (or freed) from cache since last lock of heap
 	int64 local_alloc;	// bytes allocated (or freed) since last lock of heap
@@ -311,17 +558,116 @@ struct MCache
 	int64 local_nfree;	// number of frees since last lock of heap
 	int64 local_nlookup;	// number of pointer lookups since last lock of heap
 	int32 next_sample;	// trigger heap sample after allocating this many bytes
+	int64 local_pagecache_hit;	// page cache hits since last lock of heap
+	int64 local_pagecache_miss;	// page cache misses since last lock of heap
+
+	// Page cache: pages taken from the heap in one piece and
+	// handed out as small multi-page spans without locking it.
+	MSpan *pagechunk;	// in-use span holding the cached pages, or nil
+	bool pagechunkdirty;	// pagechunk may hold non-zero bytes
+	uint32 nspancache;
+	MSpan *spancache[PageCacheSpans];	// unused MSpan structures
+
+	// Trimming state (see MCache_Trim).
+	PageID trimchunk;	// pagechunk->start as of the last trim pass
+	uint32 chunkidle;	// trim passes since the page cache was last used
+	uint32 idle;	// trim passes since the cache was last used
+	uint32 trimgen;	// runtime·trimgen as of the last trim pass
+
+	// Number of spans to take from the heap when a refill finds
+	// the MCentral empty, per span class; 0 means 1.  Doubles each
+	// time that happens and halves at each GC (see MCache_Refill).
+	uint8 growbatch[NumSpanClasses];
+
 	// Statistics about allocation size classes since last lock of heap
 	struct {
 		int64 nmalloc;
 		int64 nfree;
+		int64 nrefill;
+		int64 ngrow;
 	} local_by_size[NumSizeClasses];
 
+	// Slow path latency histograms since the last GC.
+	int64 local_alloclatency[NumAllocTiers][NumLatencyBuckets];
+
+	// Small allocations by size since the last GC (see SizeBucket).
+	int64 local_sizehist[NumSizeBuckets];
+
+	// Free objects of the first NumLocalPools pools.
+	MCachePool pools[NumLocalPools];
 };
 
-void*	runtime·MCache_Alloc(MCache *c, int32 sizeclass, uintptr size, int32 zeroed);
-void	runtime·MCache_Free(MCache *c, void *p, int32 sizeclass, uintptr size);
+void*	runtime·MCache_Alloc(MCache *c, int32 spanclass, uintptr size, int32 zeroed);
+uintptr	runtime·MCache_AllocN(MCache *c, int32 spanclass, uintptr size, int32 zeroed, void **out, uintptr n);
+MSpan*	runtime·MCache_AllocLarge(MCache *c, uintptr npage, int32 spanclass, int32 zeroed);
 void	runtime·MCache_ReleaseAll(MCache *c);
+extern	uint32	runtime·trimgen;	// bumped to ask every MCache to trim; low bit is pressure
+void	runtime·MCache_Trim(MCache *c);
+void	runtime·MCache_Latency(MCache *c, int32 tier, int64 t0);
+void	runtime·MCache_ClearPools(MCache *c);
+
+// A Pool keeps free objects of one kind for reuse, in slots of each
+// MCache and in a shared list behind them, so that most PoolGet and
+// PoolPut calls take no lock.  The collector empties every pool at
+// the start of each GC, so pooled objects never live through a cycle
+// unless in use.  The first word of an object in the shared list
+// links it to the next; PoolGet clears it.
+struct Pool
+{
+	Lock;
+	MLink	*shared;	// overflow from the MCache slots
+	uint32	nshared;
+	uint32	id;	// index of the pool's MCache slots, if < NumLocalPools
+	Pool	*alllink;	// on runtime·allpools
+};
+
+void	runtime·PoolInit(Pool *p);
+void*	runtime·PoolGet(Pool *p);
+void	runtime·PoolPut(Pool *p, void *v);
+void	runtime·clearpools(void);
+
+// Bracket a group of updates to c's local_* counters (see
+// MCache.statsseq).  Nothing in between may take a lock.
+#define MCache_BeginStats(c)	runtime·atomicstore(&(c)->statsseq, (c)->statsseq+1)
+#define MCache_EndStats(c)	runtime·atomicstore(&(c)->statsseq, (c)->statsseq+1)
+
+// MTypes describes the types of blocks allocated within a span.
+// The compression field describes the layout of the data.
+//
+// MTypes_Empty:
+//     All blocks are free, or no type information is available for
+//     allocated blocks.
+//     The data field has no meaning.
+// MTypes_Single:
+//     The span contains just one block.
+//     The data field holds the type information.
+//     The sysalloc field has no meaning.
+// MTypes_Words:
+//     The span contains multiple blocks.
+//     The data field points to an array of type [NumBlocks]uintptr,
+//     and each element of the array holds the type of the corresponding
+//     block.
+// MTypes_Bytes:
+//     The span contains at most seven different types of blocks.
+//     The data field points to the following structure:
+//         struct {
+//             type  [8]uintptr       // type[0] is always 0
+//             index [NumBlocks]byte
+//         }
+//     The type of the i-th block is: data.type[data.index[i]]
+enum
+{
+	MTypes_Empty = 0,
+	MTypes_Single = 1,
+	MTypes_Words = 2,
+	MTypes_Bytes = 3,
+};
+struct MTypes
+{
+	byte	compression;	// one of MTypes_*
+	bool	sysalloc;	// whether (void*)data is from runtime·SysAlloc
+	uintptr	data;
+};
 
 // An MSpan is a run of pages.
 enum
@@ -333,64 +679,126 @@ enum
 };
 struct MSpan
 {
+	LFNode	lfnode;		// in an MCentral's partial set; must be first
 	MSpan	*next;		// in a span linked list
 	MSpan	*prev;		// in a span linked list
 	MSpan	*allnext;	// in the list of all spans
+	MSpan	*tleft;		// in the MHeap.large treap
+	MSpan	*tright;	// in the MHeap.large treap
+	MSpan	*tparent;	// in the MHeap.large treap
+	uint32	tpriority;	// treap heap order, random
 	PageID	start;		// starting page number
 	uintptr	npages;		// number of pages in span
-	MLink	*freelist;	// list of free objects
 	uint32	ref;		// number of allocated objects in this span
 	uint32	sizeclass;	// size class
+	uint32	spanclass;	// size class and noscan bit (see SpanClass)
+	uintptr	elemsize;	// computed from sizeclass or from npages
+	uint32	divmul;		// class_to_divmul[sizeclass] (see MSpan_ObjIndex)
 	uint32	state;		// MSpanInUse etc
 	int64   unusedsince;	// First time spotted by GC in MSpanFree state
 	uintptr npreleased;	// number of pages released to the OS
 	byte	*limit;		// end of data in span
+	MTypes	types;		// types of allocated objects in this span
+
+	// Small-object allocation state.  Objects below freeindex
+	// are allocated (or freed explicitly and waiting for the
+	// next sweep); at or above it an object is free iff its bit
+	// in the allocation bitmap is clear.  alloccache holds the
+	// complement of the bitmap word containing freeindex,
+	// shifted so that bit 0 is freeindex, so the next free
+	// object is found with a count-trailing-zeros.
+	uint32	freeindex;	// first object index that may be free
+	uint32	nelems;		// number of objects in span
+	uint64	alloccache;	// ^allocation bits from freeindex on
+	uint8	needzero;	// free slots may hold stale data
+	uint8	incache;	// owned by an MCache
+	uint8	allocidx;	// which of bits[] is the allocation bitmap
+	byte	bits[2][MaxSpanObjects/8];	// allocation and mark bitmaps, swapped by sweep
 };
 
 void	runtime·MSpan_Init(MSpan *span, PageID start, uintptr npages);
-
-// Every MSpan is in one doubly-linked list,
-// either one of the MHeap's free lists or one of the
-// MCentral's span lists.  We use empty MSpan structures as list heads.
+void	runtime·MSpan_InitAlloc(MSpan *span, uint32 nelems);
+void	runtime·MSpan_RefillAllocCache(MSpan *span);
+void*	runtime·MSpan_NextFree(MSpan *span);
+
+#define MSpan_AllocBits(s)	((s)->bits[(s)->allocidx])
+#define MSpan_MarkBits(s)	((s)->bits[(s)->allocidx^1])
+
+// Every free MSpan is in one doubly-linked list, one of the
+// MHeap's free lists, except free spans of MaxMHeapList pages
+// or more, which are in the MHeap's large treap instead.
+// In-use spans of small objects are linked through lfnode
+// into their MCentral's partial set (see mcentral.c).
+// We use empty MSpan structures as list heads.
 void	runtime·MSpanList_Init(MSpan *list);
 bool	runtime·MSpanList_IsEmpty(MSpan *list);
 void	runtime·MSpanList_Insert(MSpan *list, MSpan *span);
 void	runtime·MSpanList_Remove(MSpan *span);	// from whatever list it is in
 
 
-// Central list of free objects of a given size.
+// Central set of spans of a given span class.
 struct MCentral
 {
-	Lock;
-	int32 sizeclass;
-	MSpan nonempty;
-	MSpan empty;
-	int32 nfree;
+	uint64 partial;	// lock-free stack of spans with free slots, not cached
+	int32 spanclass;
 };
 
-void	runtime·MCentral_Init(MCentral *c, int32 sizeclass);
-int32	runtime·MCentral_AllocList(MCentral *c, int32 n, MLink **first);
-void	runtime·MCentral_FreeList(MCentral *c, int32 n, MLink *first);
+void	runtime·MCentral_Init(MCentral *c, int32 spanclass);
+MSpan*	runtime·MCentral_CacheSpan(MCentral *c, int32 ngrow, int32 *ngrown);
+void	runtime·MCentral_UncacheSpan(MCentral *c, MSpan *s);
+void	runtime·MCentral_FreeSpan(MCentral *c, MSpan *s);
+void	runtime·MCentral_ResetSets(MCentral *c);
+
+// Heap memory lives in arenas: HeapArenaBytes-aligned chunks of
+// address space, not necessarily contiguous with each other.
+// Each arena the heap has touched has an MHeapArena holding the
+// GC bitmap for its words (see mgc0.c) and the span of each of
+// its pages.  Arenas are found through the two-level index
+// MHeap.arenas; index blocks and MHeapArenas are allocated as the
+// heap grows into new address space, so the metadata grows with
+// the mapped heap rather than being sized for the largest heap.
+struct MHeapArena
+{
+	byte	bitmap[HeapArenaBitmapBytes];
+	MSpan	*spans[PagesPerArena];	// nil for pages never in a span
+};
+
+#define ArenaL1(p)	((uintptr)(p)>>HeapArenaShift>>ArenaL2Bits)
+#define ArenaL2(p)	(((uintptr)(p)>>HeapArenaShift) & ((1<<ArenaL2Bits)-1))
+
+// The arena holding p, which must be heap memory.
+// Use runtime·MHeap_ArenaOf for arbitrary addresses.
+#define MHeap_Arena(h, p)	((h)->arenas[ArenaL1(p)][ArenaL2(p)])
 
 // Main malloc heap.
-// The heap itself is the "free[]" and "large" arrays,
+// The heap itself is the "free[]" lists and the "large" treap,
 // but all the other global data is here too
 struct MHeap
 {
 	Lock;
 	MSpan free[MaxMHeapList];	// free lists of given length
-	MSpan large;			// free lists length >= MaxMHeapList
-	MSpan *allspans;
+	MSpan *large;			// free spans of length >= MaxMHeapList,
+					// a treap ordered by (npages, start)
+	MSpan **allspans;
+	uint32	nspan;
+	uint32	nspancap;
 
-	// span lookup
-	MSpan *map[1<<MHeapMap_Bits];
+	// span and bitmap lookup
+	MHeapArena **arenas[1<<ArenaL1Bits];
 
-	// range of addresses we might see in the heap
-	byte *bitmap;
-	uintptr bitmap_mapped;
+	// range of addresses we might see in the heap;
+	// it can have holes that are in no arena.
 	byte *arena_start;
 	byte *arena_used;
+
+	// reserved address space not yet handed to the heap
+	byte *arena_alloc;
 	byte *arena_end;
+	uint32 arena_hint;	// 64-bit: next region to try (see MHeap_SysAlloc)
+
+	// heap growth step (see MHeap_Grow)
+	uintptr growchunk;
+	int64 lastgrow;		// runtime·nanotime of the last growth
 
 	// central free lists for small size classes.
 	// the union makes sure that the MCentrals are
@@ -399,27 +807,64 @@ struct MHeap
 	union {
 		MCentral;
 		byte pad[CacheLineSize];
-	} central[NumSizeClasses];
+	} central[NumSpanClasses];
 
-	FixAlloc spanalloc;	// allocator for Span*
-	FixAlloc cachealloc;	// allocator for MCache*
+	SlabAlloc spanalloc;	// allocator for Span*
+	SlabAlloc cachealloc;	// allocator for MCache*
 };
-extern MHeap runtime·mheap;
+extern MHeap *runtime·mheap;
 
-void	runtime·MHeap_Init(MHeap *h, void *(*allocator)(uintptr));
-MSpan*	runtime·MHeap_Alloc(MHeap *h, uintptr npage, int32 sizeclass, int32 acct);
+void	runtime·MHeap_Init(MHeap *h);
+MSpan*	runtime·MHeap_Alloc(MHeap *h, uintptr npage, int32 spanclass, int32 acct, int32 zeroed);
+int32	runtime·MHeap_AllocSpans(MHeap *h, uintptr npage, int32 spanclass, int32 zeroed, MSpan **spans, int32 n);
 void	runtime·MHeap_Free(MHeap *h, MSpan *s, int32 acct);
+void	runtime·MHeap_FreeList(MHeap *h, MSpan *list, int32 acct);
+bool	runtime·MHeap_Extend(MHeap *h, MSpan *s, uintptr npage, int32 zeroed);
 MSpan*	runtime·MHeap_Lookup(MHeap *h, void *v);
 MSpan*	runtime·MHeap_LookupMaybe(MHeap *h, void *v);
+MHeapArena*	runtime·MHeap_ArenaOf(MHeap *h, void *v);
+MSpan*	runtime·MHeap_RefillPageCache(MHeap *h, MSpan *old, uintptr npage, MSpan **spans, uint32 *nspans, uint32 max);
+void	runtime·MHeap_FreePageCache(MHeap *h, MSpan *chunk, MSpan **spans, uint32 nspans);
+void	runtime·MHeap_SplitSpan(MHeap *h, MSpan *chunk, MSpan *s, uintptr npage);
+void	runtime·MHeap_MapArenas(MHeap *h, byte *v, uintptr n);
 void	runtime·MGetSizeClassInfo(int32 sizeclass, uintptr *size, int32 *npages, int32 *nobj);
 void*	runtime·MHeap_SysAlloc(MHeap *h, uintptr n);
-void	runtime·MHeap_MapBits(MHeap *h);
 void	runtime·MHeap_Scavenger(void);
 
 void*	runtime·mallocgc(uintptr size, uint32 flag, int32 dogc, int32 zeroed);
+void	runtime·mallocgc_batch(uintptr size, uint32 flag, uintptr n, void **out);
+void*	runtime·growalloc(void *v, uintptr newsize);
 int32	runtime·mlookup(void *v, byte **base, uintptr *size, MSpan **s);
+// A region of objects that are freed together (see mregion.c).
+// Objects are bump-allocated from chunks, large objects of their
+// own from the heap, each of which starts with a pointer to the
+// previous one, so that the collector, scanning from the Region,
+// keeps all of them alive.  RegionFree gives back every chunk at
+// once; a Region dropped without RegionFree is collected as
+// ordinary garbage.
+enum
+{
+	RegionChunkSize = 64<<10,
+};
+struct Region
+{
+	byte	*chunk;	// current chunk
+	byte	*next;	// next free byte in it
+	byte	*end;	// end of it
+	uintptr	nchunk;
+	uintptr	alloc;	// bytes handed out
+};
+
+Region*	runtime·RegionNew(void);
+void*	runtime·RegionAlloc(Region *r, uintptr size);
+void	runtime·RegionFree(Region *r);
+
 void	runtime·gc(int32 force);
-void	runtime·markallocated(void *v, uintptr n, bool noptr);
+extern	uint64	runtime·heaphint;	// expected startup heap size in bytes, 0 if none
+extern	int64	runtime·gcmemlimit;	// soft memory limit in bytes, < 0 if none
+uint64	runtime·nonheapsys(void);
+void	runtime·markallocated(void *v, uintptr n);
+void	runtime·markallocatedbatch(void **v, uintptr nv, uintptr n);
 void	runtime·checkallocated(void *v, uintptr n);
 void	runtime·markfreed(void *v, uintptr n);
 void	runtime·checkfreed(void *v, uintptr n);
@@ -428,7 +873,14 @@ void	runtime·markspan(void *v, uintptr size, uintptr n, bool leftover);
 void	runtime·unmarkspan(void *v, uintptr size);
 bool	runtime·blockspecial(void*);
 void	runtime·setblockspecial(void*, bool);
-void	runtime·purgecachedstats(M*);
+void	runtime·purgecachedstats(MCache*);
+void*	runtime·cnew(Type*);
+void	runtime·cnewbatch(Type*, uintptr, void**);
+
+void	runtime·settype(void*, uintptr);
+void	runtime·settype_flush(M*, bool);
+void	runtime·settype_sysfree(MSpan*);
+uintptr	runtime·gettype(void*);
 
 enum
 {
@@ -436,6 +888,9 @@ enum
 	FlagNoPointers = 1<<0,	// no pointers here
 	FlagNoProfiling = 1<<1,	// must not profile
 	FlagNoGC = 1<<2,	// must not free or scan for pointers
+	FlagNoTiny = 1<<3,	// must not share a tiny block (see mallocgc)
+	FlagAlign64 = 1<<4,	// start on a 64-byte boundary
+	FlagAlignPage = 1<<5,	// start on a page boundary
 };
 
 void	runtime·MProf_Malloc(void*, uintptr);
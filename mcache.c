@@ -0,0 +1,499 @@
+// Copyright 2009 The Go Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Per-thread (in Go, per-M) malloc cache for small objects
+// and for large objects of a few pages.
+//
+// See malloc.h for an overview.
+
+#include "runtime.h"
+#include "arch_GOARCH.h"
+#include "malloc.h"
+
+// Index of the lowest set bit, by de Bruijn multiplication.
+static int8 debruijn64tab[64] = {
+	0, 1, 56, 2, 57, 49, 28, 3, 61, 58, 42, 50, 38, 29, 17, 4,
+	62, 47, 59, 36, 45, 43, 51, 22, 53, 39, 33, 30, 24, 18, 12, 5,
+	63, 55, 48, 27, 60, 41, 37, 16, 46, 35, 44, 21, 52, 32, 23, 11,
+	54, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19, 9, 13, 8, 7, 6,
+};
+
+static int32
+ctz64(uint64 x)
+{
+	return debruijn64tab[((x & -x) * 0x03f79d71b4ca8b09ULL) >> 58];
+}
+
+// Prepare s, freshly carved into nelems objects or just swept,
+// for allocation from the start of its allocation bitmap.
+void
+runtime·MSpan_InitAlloc(MSpan *s, uint32 nelems)
+{
+	s->nelems = nelems;
+	s->freeindex = 0;
+	runtime·MSpan_RefillAllocCache(s);
+}
+
+// Load the allocation bitmap word containing s->freeindex
+// into s->alloccache, complemented so that free objects are 1s.
+void
+runtime·MSpan_RefillAllocCache(MSpan *s)
+{
+	byte *b;
+	uint64 x;
+	int32 i;
+
+	b = &MSpan_AllocBits(s)[(s->freeindex/64)*8];
+	x = 0;
+	for(i=0; i<8; i++)
+		x |= (uint64)b[i] << (8*i);
+	s->alloccache = ~x >> (s->freeindex%64);
+}
+
+// Return the next free object in s and advance s->freeindex
+// past it, or return nil if s has no free objects left.
+// The caller must own s: it is cached by the caller's MCache.
+void*
+runtime·MSpan_NextFree(MSpan *s)
+{
+	uint32 i, n;
+
+	while(s->alloccache == 0) {
+		// No free objects in the rest of this bitmap word.
+		s->freeindex = (s->freeindex + 64) & ~63;
+		if(s->freeindex >= s->nelems) {
+			s->freeindex = s->nelems;
+			return nil;
+		}
+		runtime·MSpan_RefillAllocCache(s);
+	}
+	n = ctz64(s->alloccache);
+	i = s->freeindex + n;
+	if(i >= s->nelems) {
+		// The 1s past the last object are not objects.
+		s->freeindex = s->nelems;
+		s->alloccache = 0;
+		return nil;
+	}
+	s->freeindex = i+1;
+	if(s->freeindex%64 == 0) {
+		if(s->freeindex < s->nelems)
+			runtime·MSpan_RefillAllocCache(s);
+		else
+			s->alloccache = 0;
+	} else
+		s->alloccache >>= n+1;
+	return (byte*)(s->start<<PageShift) + i*s->elemsize;
+}
+
+// Exchange the span cached for spanclass, which has run out
+// of free objects, for one from the central lists.
+//
+// When the MCentral has no span to give, it takes
+// c->growbatch[spanclass] spans from the heap at once and
+// keeps the extra ones.  Finding the MCentral empty means
+// this M allocates from the class faster than the sweep and
+// other Ms return spans, so the batch doubles, up to
+// MaxGrowSpans or MaxMCacheSize bytes of spans; MCache_ReleaseAll
+// halves it at every GC, so that it follows the recent rate.
+static MSpan*
+MCache_Refill(MCache *c, int32 spanclass)
+{
+	MCacheList *l;
+	MCentral *central;
+	MSpan *s;
+	int32 sizeclass, batch, max, ngrown;
+	int64 t0;
+
+	t0 = runtime·nanotime();
+	l = &c->list[spanclass];
+	central = &runtime·mheap->central[spanclass];
+	if(l->span != nil) {
+		runtime·MCentral_UncacheSpan(central, l->span);
+		l->span = nil;
+	}
+	sizeclass = SpanClass_SizeClass(spanclass);
+	batch = c->growbatch[spanclass];
+	if(batch == 0)
+		batch = 1;
+	s = runtime·MCentral_CacheSpan(central, batch, &ngrown);
+	MCache_BeginStats(c);
+	c->local_by_size[sizeclass].nrefill++;
+	if(ngrown > 0)
+		c->local_by_size[sizeclass].ngrow++;
+	MCache_EndStats(c);
+	if(ngrown > 0) {
+		max = MaxMCacheSize / (runtime·class_to_allocnpages[sizeclass]<<PageShift);
+		if(max > MaxGrowSpans)
+			max = MaxGrowSpans;
+		if(batch*2 <= max)
+			c->growbatch[spanclass] = batch*2;
+	}
+	if(s != nil) {
+		l->span = s;
+		c->size += (uintptr)(s->nelems - s->ref) * s->elemsize;
+	}
+	runtime·MCache_Latency(c, AllocTierCache, t0);
+	return s;
+}
+
+void*
+runtime·MCache_Alloc(MCache *c, int32 spanclass, uintptr size, int32 zeroed)
+{
+	MSpan *s;
+	void *v;
+
+	s = c->list[spanclass].span;
+	if(s == nil || (v = runtime·MSpan_NextFree(s)) == nil) {
+		s = MCache_Refill(c, spanclass);
+		if(s == nil)
+			return nil;
+		v = runtime·MSpan_NextFree(s);
+		if(v == nil)
+			runtime·throw("MCache_Alloc: central span has no free objects");
+	}
+	s->ref++;
+	c->size -= size;
+
+	if(zeroed && s->needzero)
+		runtime·memclr((byte*)v, size);
+	return v;
+}
+
+// Give c's page cache back to the heap.
+static void
+MCache_FlushPages(MCache *c)
+{
+	if(c->pagechunk == nil && c->nspancache == 0)
+		return;
+	if(c->pagechunk != nil && c->pagechunkdirty)
+		*(uintptr*)(c->pagechunk->start<<PageShift) = 1;  // needs zeroing
+	runtime·MHeap_FreePageCache(runtime·mheap, c->pagechunk, c->spancache, c->nspancache);
+	c->pagechunk = nil;
+	c->nspancache = 0;
+}
+
+// Allocate n objects of spanclass into out[0:n], taking each run
+// of them from the cached span before moving on to the next one.
+// Returns the number allocated, which is less than n only if
+// out of memory.  The caller counts them in c's statistics.
+uintptr
+runtime·MCache_AllocN(MCache *c, int32 spanclass, uintptr size, int32 zeroed, void **out, uintptr n)
+{
+	MSpan *s;
+	void *v;
+	uintptr i;
+
+	s = c->list[spanclass].span;
+	for(i=0; i<n; i++) {
+		if(s == nil || (v = runtime·MSpan_NextFree(s)) == nil) {
+			s = MCache_Refill(c, spanclass);
+			if(s == nil)
+				break;
+			v = runtime·MSpan_NextFree(s);
+			if(v == nil)
+				runtime·throw("MCache_AllocN: central span has no free objects");
+		}
+		s->ref++;
+		if(zeroed && s->needzero)
+			runtime·memclr((byte*)v, size);
+		out[i] = v;
+	}
+	c->size -= i*size;
+	return i;
+}
+
+// Allocate a span of npage pages for a single object larger than
+// MaxSmallSize and no larger than MaxPageCacheSize.  The span is
+// carved from the front of c->pagechunk without locking the heap;
+// only refilling the chunk does.  Counts the allocation in c's
+// statistics.  Returns nil if out of memory.
+MSpan*
+runtime·MCache_AllocLarge(MCache *c, uintptr npage, int32 spanclass, int32 zeroed)
+{
+	MSpan *s, *chunk;
+	bool hit;
+	uintptr size;
+	int64 t0;
+
+	chunk = c->pagechunk;
+	hit = true;
+	if(chunk == nil || chunk->npages < npage || c->nspancache == 0) {
+		hit = false;
+		t0 = runtime·nanotime();
+		if(chunk != nil && c->pagechunkdirty)
+			*(uintptr*)(chunk->start<<PageShift) = 1;  // needs zeroing
+		c->pagechunk = nil;
+		chunk = runtime·MHeap_RefillPageCache(runtime·mheap, chunk, PageCacheChunk>>PageShift,
+			c->spancache, &c->nspancache, nelem(c->spancache));
+		runtime·MCache_Latency(c, AllocTierCache, t0);
+		if(chunk == nil)
+			return nil;
+		c->pagechunk = chunk;
+		// The first word says whether the whole chunk is zero
+		// (see MHeap_AllocLocked); carving does not change that.
+		c->pagechunkdirty = *(uintptr*)(chunk->start<<PageShift) != 0;
+	}
+
+	if(chunk->npages == npage) {
+		s = chunk;
+		c->pagechunk = nil;
+	} else {
+		s = c->spancache[--c->nspancache];
+		runtime·MHeap_SplitSpan(runtime·mheap, chunk, s, npage);
+	}
+	s->spanclass = spanclass;
+	if(zeroed && c->pagechunkdirty)
+		runtime·memclr((byte*)(s->start<<PageShift), npage<<PageShift);
+	size = npage<<PageShift;
+	MCache_BeginStats(c);
+	if(hit)
+		c->local_pagecache_hit++;
+	else
+		c->local_pagecache_miss++;
+	c->local_nmalloc++;
+	c->local_cachealloc += size;
+	c->local_objects++;
+	c->local_alloc += size;
+	c->local_total_alloc += size;
+	MCache_EndStats(c);
+	return s;
+}
+
+// Count the time since t0, a runtime·nanotime, in c's latency
+// histogram for the given slow path tier.  c may be nil early
+// in bootstrap, before the M has a cache.
+void
+runtime·MCache_Latency(MCache *c, int32 tier, int64 t0)
+{
+	int64 ns;
+	int32 b;
+
+	if(c == nil)
+		return;
+	ns = runtime·nanotime() - t0;
+	for(b=0; ns > 1 && b < NumLatencyBuckets-1; b++)
+		ns >>= 1;
+	MCache_BeginStats(c);
+	c->local_alloclatency[tier][b]++;
+	MCache_EndStats(c);
+}
+
+void
+runtime·MCache_ReleaseAll(MCache *c)
+{
+	int32 i;
+	MCacheList *l;
+
+	for(i=0; i<NumSpanClasses; i++) {
+		l = &c->list[i];
+		if(l->span != nil) {
+			runtime·MCentral_UncacheSpan(&runtime·mheap->central[i], l->span);
+			l->span = nil;
+		}
+	}
+	c->size = 0;
+
+	// The tiny block is not a GC root; a swept block
+	// must not be carved any further.
+	c->tiny = nil;
+	c->tinysize = 0;
+
+	for(i=0; i<NumSpanClasses; i++)
+		c->growbatch[i] >>= 1;
+
+	// Cached pages go back to the heap so that they can
+	// coalesce with whatever the sweep frees around them.
+	MCache_FlushPages(c);
+}
+
+enum
+{
+	TrimListPasses = 2,	// uncache a list unused for this many trim passes
+	TrimCachePasses = 6,	// release a cache unused for this many
+};
+
+uint32 runtime·trimgen;
+
+// Return what c holds but does not use to the MCentrals and the
+// heap, so that Ps do not strand free memory until the next GC.
+// Every few seconds the scavenger bumps runtime·trimgen, and the
+// M that owns c calls this from mallocgc the next time it
+// allocates, so no locks beyond those of the MCentrals and the
+// heap are needed.  A P that allocates nothing keeps its cache
+// until the next collection releases it (MCache_ReleaseAll).
+//
+// Much as the old free lists kept a low-water mark (nlistmin) of
+// what they did not need, each list remembers its span and free
+// index at every pass; a list that has not moved for TrimListPasses
+// passes gives its span back.  A cache that has allocated nothing
+// for TrimCachePasses passes is released in full.  Under memory
+// pressure one idle pass is enough for either.
+void
+runtime·MCache_Trim(MCache *c)
+{
+	int32 i;
+	uint32 listpasses, cachepasses;
+	MCacheList *l;
+	MSpan *s;
+	bool used, pressure;
+
+	c->trimgen = runtime·atomicload(&runtime·trimgen);
+	pressure = c->trimgen & 1;
+	listpasses = pressure ? 1 : TrimListPasses;
+	cachepasses = pressure ? 1 : TrimCachePasses;
+	used = false;
+	for(i=0; i<NumSpanClasses; i++) {
+		l = &c->list[i];
+		s = l->span;
+		if(s == nil)
+			continue;
+		if(s != l->trimspan || s->freeindex != l->trimfree) {
+			l->trimspan = s;
+			l->trimfree = s->freeindex;
+			l->idle = 0;
+			used = true;
+			continue;
+		}
+		if(++l->idle >= listpasses) {
+			c->size -= (uintptr)(s->nelems - s->ref) * s->elemsize;
+			runtime·MCentral_UncacheSpan(&runtime·mheap->central[i], s);
+			l->span = nil;
+			l->trimspan = nil;
+			l->idle = 0;
+		}
+	}
+
+	if(c->pagechunk != nil) {
+		if(c->pagechunk->start != c->trimchunk) {
+			c->trimchunk = c->pagechunk->start;
+			c->chunkidle = 0;
+			used = true;
+		} else if(++c->chunkidle >= listpasses) {
+			MCache_FlushPages(c);
+			c->chunkidle = 0;
+		}
+	}
+
+	if(used)
+		c->idle = 0;
+	else if(++c->idle >= cachepasses) {
+		runtime·MCache_ReleaseAll(c);
+		c->idle = 0;
+	}
+}
+
+static Lock poolslock;
+static Pool *allpools;
+static uint32 npools;
+
+// Register p, which must be zeroed and must not move or be freed.
+void
+runtime·PoolInit(Pool *p)
+{
+	runtime·lock(&poolslock);
+	p->id = npools++;
+	p->alllink = allpools;
+	allpools = p;
+	runtime·unlock(&poolslock);
+}
+
+// Take a free object from p, or return nil if it has none.
+// Tries this M's slots first, then takes a few objects at once
+// from the shared list.
+void*
+runtime·PoolGet(Pool *p)
+{
+	MCachePool *l;
+	MLink *v;
+
+	l = nil;
+	if(p->id < NumLocalPools) {
+		l = &m->mcache->pools[p->id];
+		if(l->n > 0)
+			return l->obj[--l->n];
+	}
+	if(p->shared == nil)
+		return nil;
+	runtime·lock(p);
+	v = p->shared;
+	if(v != nil) {
+		p->shared = v->next;
+		p->nshared--;
+		while(l != nil && l->n < PoolLocalSize/2 && p->shared != nil) {
+			l->obj[l->n] = p->shared;
+			p->shared = p->shared->next;
+			((MLink*)l->obj[l->n])->next = nil;
+			l->n++;
+			p->nshared--;
+		}
+	}
+	runtime·unlock(p);
+	if(v != nil)
+		v->next = nil;
+	return v;
+}
+
+// Give v, which must be at least a pointer in size, to p for
+// reuse.  When this M's slots are full, half of them move to
+// the shared list.
+void
+runtime·PoolPut(Pool *p, void *v)
+{
+	MCachePool *l;
+	MLink *x;
+
+	if(v == nil)
+		return;
+	if(p->id < NumLocalPools) {
+		l = &m->mcache->pools[p->id];
+		if(l->n < PoolLocalSize) {
+			l->obj[l->n++] = v;
+			return;
+		}
+		runtime·lock(p);
+		while(l->n > PoolLocalSize/2) {
+			x = l->obj[--l->n];
+			x->next = p->shared;
+			p->shared = x;
+			p->nshared++;
+		}
+		l->obj[l->n++] = v;
+		runtime·unlock(p);
+		return;
+	}
+	x = v;
+	runtime·lock(p);
+	x->next = p->shared;
+	p->shared = x;
+	p->nshared++;
+	runtime·unlock(p);
+}
+
+// Drop the objects in c's pool slots.
+// Called by the collector with the world stopped.
+void
+runtime·MCache_ClearPools(MCache *c)
+{
+	runtime·memclr((byte*)c->pools, sizeof c->pools);
+}
+
+// Drop the objects in the shared lists of all pools.  Called at
+// the start of each GC, with the world stopped, along with
+// MCache_ClearPools for every cache; the objects are then garbage
+// unless in use elsewhere.
+void
+runtime·clearpools(void)
+{
+	Pool *p;
+
+	runtime·lock(&poolslock);
+	for(p=allpools; p; p=p->alllink) {
+		runtime·lock(p);
+		p->shared = nil;
+		p->nshared = 0;
+		runtime·unlock(p);
+	}
+	runtime·unlock(&poolslock);
+}
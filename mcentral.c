@@ -0,0 +1,166 @@
+// Copyright 2009 The Go Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Central free lists.
+//
+// See malloc.h for an overview.
+//
+// The MCentral doesn't actually contain the list of free objects; the MSpan does.
+// Each MCentral is a lock-free stack of the spans that have free objects
+// and are not cached by any MCache (c->partial).  Free objects are found
+// through each span's allocation bitmap, so moving a span in or out of
+// the stack never touches the objects in it.
+//
+// Spans with no free objects are in no set: only the sweeper can give
+// them free slots back, and it finds every span through h->allspans.
+// At the start of each collection the partial stacks are emptied
+// (MCentral_ResetSets) and the sweeper pushes each swept span that
+// still has free slots (MCentral_FreeSpan), so no span ever has to be
+// removed from the middle of a stack.
+
+#include "runtime.h"
+#include "arch_GOARCH.h"
+#include "malloc.h"
+
+static MSpan* MCentral_Grow(MCentral *c, int32 n, int32 *ngrown);
+
+// Initialize a single central free list.
+void
+runtime·MCentral_Init(MCentral *c, int32 spanclass)
+{
+	uintptr size;
+	int32 npages, nobj;
+
+	if(((uintptr)&c->partial & 7) != 0)
+		runtime·throw("MCentral_Init: span set is misaligned");
+	c->spanclass = spanclass;
+	c->partial = 0;
+
+	if(SpanClass_SizeClass(spanclass) != 0) {
+		runtime·MGetSizeClassInfo(SpanClass_SizeClass(spanclass), &size, &npages, &nobj);
+		if(nobj > MaxSpanObjects)
+			runtime·throw("MCentral_Init: span bitmap too small for size class");
+	}
+}
+
+// Hand a span with free objects to an MCache.
+// The span is in no set until the MCache gives it back,
+// so no other MCache can allocate from it.
+// If c has no span with free objects, takes up to ngrow new
+// spans from the heap, keeping the others in c's set, and
+// sets *ngrown to the number taken (otherwise to 0).
+// Returns nil if out of memory.
+MSpan*
+runtime·MCentral_CacheSpan(MCentral *c, int32 ngrow, int32 *ngrown)
+{
+	MSpan *s;
+
+	*ngrown = 0;
+	s = (MSpan*)runtime·lfstackpop(&c->partial);
+	if(s == nil) {
+		s = MCentral_Grow(c, ngrow, ngrown);
+		if(s == nil)
+			return nil;
+	}
+	s->incache = 1;
+	return s;
+}
+
+// Return a span from an MCache.  Its allocation state
+// (freeindex, alloccache) is kept, so the next MCache
+// continues where this one stopped.
+void
+runtime·MCentral_UncacheSpan(MCentral *c, MSpan *s)
+{
+	s->incache = 0;
+	if(s->ref < s->nelems)
+		runtime·lfstackpush(&c->partial, &s->lfnode);
+}
+
+// Empty the span set of c.  Called with the world stopped,
+// after every MCache has given back its spans and before the
+// sweep, which puts back the spans that still have room.
+void
+runtime·MCentral_ResetSets(MCentral *c)
+{
+	c->partial = 0;
+}
+
+// Called by the sweeper after it has swapped in a new allocation
+// bitmap for s and set s->ref to the number of surviving objects.
+// Puts s back in the partial set if it has free objects, or returns
+// it to the heap if nothing in it survived.  Spans are swept in
+// parallel, so this must not take any lock but the heap's.
+void
+runtime·MCentral_FreeSpan(MCentral *c, MSpan *s)
+{
+	if(s->incache)
+		runtime·throw("MCentral_FreeSpan: span is cached");
+
+	if(s->ref == 0) {
+		*(uintptr*)(s->start<<PageShift) = 1;  // needs zeroing
+		runtime·unmarkspan((byte*)(s->start<<PageShift), s->npages<<PageShift);
+		runtime·MHeap_Free(runtime·mheap, s, 0);
+		return;
+	}
+	if(s->ref < s->nelems)
+		runtime·lfstackpush(&c->partial, &s->lfnode);
+}
+
+void
+runtime·MGetSizeClassInfo(int32 sizeclass, uintptr *sizep, int32 *npagesp, int32 *nobj)
+{
+	int32 size;
+	int32 npages;
+
+	npages = runtime·class_to_allocnpages[sizeclass];
+	size = runtime·class_to_size[sizeclass];
+	*npagesp = npages;
+	*sizep = size;
+	*nobj = (npages << PageShift) / size;
+}
+
+// Fetch up to nspan new spans from the heap, in one acquisition
+// of the heap lock, and carve them into objects.  The first span
+// goes straight to the caller's MCache, the others into c's set.
+// Sets *ngrown to the number of spans fetched.
+static MSpan*
+MCentral_Grow(MCentral *c, int32 nspan, int32 *ngrown)
+{
+	int32 npages, n, i, got;
+	uintptr size;
+	MSpan *s, *spans[MaxGrowSpans];
+	int64 t0;
+
+	t0 = runtime·nanotime();
+	if(nspan < 1)
+		nspan = 1;
+	if(nspan > MaxGrowSpans)
+		nspan = MaxGrowSpans;
+	runtime·MGetSizeClassInfo(SpanClass_SizeClass(c->spanclass), &size, &npages, &n);
+	got = runtime·MHeap_AllocSpans(runtime·mheap, npages, c->spanclass, 1, spans, nspan);
+	if(got == 0) {
+		// TODO(rsc): Log out of memory
+		runtime·MCache_Latency(m->mcache, AllocTierCentral, t0);
+		return nil;
+	}
+
+	for(i=0; i<got; i++) {
+		// The span is fresh from the heap: all slots are free and zeroed.
+		s = spans[i];
+		s->limit = (byte*)(s->start << PageShift) + size*n;
+		s->ref = 0;
+		s->needzero = 0;
+		s->incache = 0;
+		s->allocidx = 0;
+		runtime·memclr(s->bits[0], sizeof s->bits[0]);
+		runtime·MSpan_InitAlloc(s, n);
+		runtime·markspan((byte*)(s->start<<PageShift), size, n, size*n < (s->npages<<PageShift));
+		if(i > 0)
+			runtime·lfstackpush(&c->partial, &s->lfnode);
+	}
+	*ngrown = got;
+	runtime·MCache_Latency(m->mcache, AllocTierCentral, t0);
+	return spans[0];
+}
@@ -37,14 +37,14 @@ enum {
    字节中的位先根据类型,再根据堆中的分配位置进行打包,因此每个64位的标记位图从上到下依次包括:
 	16位特殊位,对应堆字节
 	16位垃圾回收的标记位
-	16字节的 无指针/块边界 的标记位
+	16位的 块边界 标记位
 	16位的 已分配 标记位
    这样设计使得对一个类型的相应的位进行遍历很容易.
 
-   地址与它们的标记位图是分开存储和.以mheap.arena_start地址为边界,向上是实际的地址空间,向下是标记位图.
+   地址与它们的标记位图是分开存储的.每个arena的标记位图在它的MHeapArena.bitmap中.
    比如在64位系统中,计算某个地址的标记位的公式如下:
-	偏移 = 地址 - mheap.arena_start
-	标记位地址 = mheap.arena_start - 偏移/16 - 1 
+	偏移 = (地址 - arena起始地址)/8
+	标记位地址 = (uintptr*)arena->bitmap + 偏移/16
 	移位 = 偏移 % 16
 	标记位 = *标记位地址 >> 移位
 */
@@ -57,24 +57,29 @@ enum {
 // The bits in the word are packed together by type first, then by
 // heap location, so each 64-bit bitmap word consists of, from top to bottom,
 // the 16 bitSpecial bits for the corresponding heap words, then the 16 bitMarked bits,
-// then the 16 bitNoPointers/bitBlockBoundary bits, then the 16 bitAllocated bits.
+// then the 16 bitBlockBoundary bits, then the 16 bitAllocated bits.
 // This layout makes it easier to iterate over the bits of a given type.
 //
-// The bitmap starts at mheap.arena_start and extends *backward* from
-// there.  On a 64-bit system the off'th word in the arena is tracked by
-// the off/16+1'th word before mheap.arena_start.  (On a 32-bit system,
-// the only difference is that the divisor is 8.)
+// Each heap arena has its own bitmap, in its MHeapArena.  On a 64-bit
+// system the off'th word in the arena is tracked by the off/16'th word
+// of the arena's bitmap.  (On a 32-bit system, the only difference is
+// that the divisor is 8.)
 //
 // To pull out the bits corresponding to a given pointer p, we use:
 //
-//	off = p - (uintptr*)mheap.arena_start;  // word offset
-//	b = (uintptr*)mheap.arena_start - off/wordsPerBitmapWord - 1;
+//	ha = MHeap_Arena(mheap, p);  // or runtime·MHeap_ArenaOf(mheap, p)
+//	off = ((uintptr)p & (HeapArenaBytes-1)) / PtrSize;  // word offset
+//	b = (uintptr*)ha->bitmap + off/wordsPerBitmapWord;
 //	shift = off % wordsPerBitmapWord
 //	bits = *b >> shift;
 //	/* then test bits & bitAllocated, bits & bitMarked, etc. */
 //
+// A bitmap word never covers more than one arena.
+//
+// Whether an object has pointers is not in the bitmap: pointer-free
+// objects are in spans of a noscan span class (see SpanClass).
+//
 #define bitAllocated		((uintptr)1<<(bitShift*0))
-#define bitNoPointers		((uintptr)1<<(bitShift*1))	/* when bitAllocated is set */
 #define bitMarked		((uintptr)1<<(bitShift*2))	/* when bitAllocated is set */
 #define bitSpecial		((uintptr)1<<(bitShift*3))	/* when bitAllocated is set - has finalizer or being profiled */
 #define bitBlockBoundary	((uintptr)1<<(bitShift*1))	/* when bitAllocated is NOT set */
@@ -216,13 +221,18 @@ static bool
 markonly(void *obj)
 {
 	byte *p;
-	uintptr *bitp, bits, shift, x, xbits, off;
+	uintptr *bitp, bits, shift, xbits, off;
+	MHeapArena *ha, **l2;
 	MSpan *s;
 	PageID k;
 
-	// Words outside the arena cannot be pointers.
+	// Words outside the arenas cannot be pointers.
+	// (Manually inlined copy of runtime·MHeap_ArenaOf.)
 	if(obj < runtime·mheap->arena_start || obj >= runtime·mheap->arena_used)
 		return false;
+	l2 = runtime·mheap->arenas[ArenaL1(obj)];
+	if(l2 == nil || (ha = l2[ArenaL2(obj)]) == nil)
+		return false;
 
 	// obj may be a pointer to a live object.
 	// Try to find the beginning of the object.
@@ -234,8 +244,8 @@ markonly(void *obj)
 	obj = (void*)((uintptr)obj & ~((uintptr)PtrSize-1));
 
 	// Find bits for this word.
-	off = (uintptr*)obj - (uintptr*)runtime·mheap->arena_start;
-	bitp = (uintptr*)runtime·mheap->arena_start - off/wordsPerBitmapWord - 1;
+	off = ((uintptr)obj & (HeapArenaBytes-1)) / PtrSize;
+	bitp = (uintptr*)ha->bitmap + off/wordsPerBitmapWord;
 	shift = off % wordsPerBitmapWord;
 	xbits = *bitp;
 	bits = xbits >> shift;
@@ -248,10 +258,7 @@ markonly(void *obj)
 	// (Manually inlined copy of MHeap_LookupMaybe.)
 	/* 下面这段代码跟MHeap_LookupMaybe功能一样的，就是给定一个指针，查找对应的MSpan */
 	k = (uintptr)obj>>PageShift;
-	x = k;
-	if(sizeof(void*) == 8)
-		x -= (uintptr)runtime·mheap->arena_start>>PageShift;
-	s = runtime·mheap->map[x];
+	s = ha->spans[k & (PagesPerArena-1)];
 	if(s == nil || k < s->start || k - s->start >= s->npages || s->state != MSpanInUse)
 		return false;
 	/* 再由MSpan的对象尺寸类别，得到指针的对象边界 */
@@ -261,15 +268,15 @@ markonly(void *obj)
 	} else {
 		if((byte*)obj >= (byte*)s->limit)
 			return false;
-		uintptr size = s->elemsize;
-		int32 i = ((byte*)obj - p)/size;
-		obj = p+i*size;
+		obj = p + MSpan_ObjIndex(s, (byte*)obj - p)*s->elemsize;
 	}
 
 	/* 得到对象头地址之后，重新加载位图中的标记位 */
 	// Now that we know the object header, reload bits.
-	off = (uintptr*)obj - (uintptr*)runtime·mheap->arena_start;
-	bitp = (uintptr*)runtime·mheap->arena_start - off/wordsPerBitmapWord - 1;
+	// A large object can start in an earlier arena.
+	ha = MHeap_Arena(runtime·mheap, obj);
+	off = ((uintptr)obj & (HeapArenaBytes-1)) / PtrSize;
+	bitp = (uintptr*)ha->bitmap + off/wordsPerBitmapWord;
 	shift = off % wordsPerBitmapWord;
 	xbits = *bitp;
 	bits = xbits >> shift;
@@ -352,8 +359,9 @@ static void enqueue(Obj obj, Workbuf **_wbuf, Obj **_wp, uintptr *_nobj);
 static void
 flushptrbuf(PtrTarget *ptrbuf, PtrTarget **ptrbufpos, Obj **_wp, Workbuf **_wbuf, uintptr *_nobj, BitTarget *bitbuf)
 {
-	byte *p, *arena_start, *obj;
-	uintptr size, *bitp, bits, shift, j, x, xbits, off, nobj, ti, n;
+	byte *p, *obj;
+	uintptr *bitp, bits, shift, j, xbits, off, nobj, ti, n;
+	MHeapArena *ha, **l2;
 	MSpan *s;
 	PageID k;
 	Obj *wp;
@@ -361,8 +369,6 @@ flushptrbuf(PtrTarget *ptrbuf, PtrTarget **ptrbufpos, Obj **_wp, Workbuf **_wbuf
 	PtrTarget *ptrbuf_end;
 	BitTarget *bitbufpos, *bt;
 
-	arena_start = runtime·mheap->arena_start;
-
 	wp = *_wp;
 	wbuf = *_wbuf;
 	nobj = *_nobj;
@@ -418,9 +424,15 @@ flushptrbuf(PtrTarget *ptrbuf, PtrTarget **ptrbufpos, Obj **_wp, Workbuf **_wbuf
 				ti = 0;
 			}
 
+			// [arena_start, arena_used) can have holes.
+			// (Manually inlined copy of runtime·MHeap_ArenaOf.)
+			l2 = runtime·mheap->arenas[ArenaL1(obj)];
+			if(l2 == nil || (ha = l2[ArenaL2(obj)]) == nil)
+				continue;
+
 			// Find bits for this word.找到这个字对应的位图的标记位
-			off = (uintptr*)obj - (uintptr*)arena_start;
-			bitp = (uintptr*)arena_start - off/wordsPerBitmapWord - 1;
+			off = ((uintptr)obj & (HeapArenaBytes-1)) / PtrSize;
+			bitp = (uintptr*)ha->bitmap + off/wordsPerBitmapWord;
 			shift = off % wordsPerBitmapWord;
 			xbits = *bitp;
 			bits = xbits >> shift;
@@ -447,10 +459,7 @@ flushptrbuf(PtrTarget *ptrbuf, PtrTarget **ptrbufpos, Obj **_wp, Workbuf **_wbuf
 			// Otherwise consult span table to find beginning.
 			// (Manually inlined copy of MHeap_LookupMaybe.)
 			k = (uintptr)obj>>PageShift;
-			x = k;
-			if(sizeof(void*) == 8)
-				x -= (uintptr)arena_start>>PageShift;
-			s = runtime·mheap->map[x];
+			s = ha->spans[k & (PagesPerArena-1)];
 			if(s == nil || k < s->start || k - s->start >= s->npages || s->state != MSpanInUse)
 				continue;
 			p = (byte*)((uintptr)s->start<<PageShift);
@@ -459,14 +468,14 @@ flushptrbuf(PtrTarget *ptrbuf, PtrTarget **ptrbufpos, Obj **_wp, Workbuf **_wbuf
 			} else {
 				if((byte*)obj >= (byte*)s->limit)
 					continue;
-				size = s->elemsize;
-				int32 i = ((byte*)obj - p)/size;
-				obj = p+i*size;
+				obj = p + MSpan_ObjIndex(s, (byte*)obj - p)*s->elemsize;
 			}
 
 			// Now that we know the object header, reload bits.找到对象边界后,重新加载标记位
-			off = (uintptr*)obj - (uintptr*)arena_start;
-			bitp = (uintptr*)arena_start - off/wordsPerBitmapWord - 1;
+			// A large object can start in an earlier arena.
+			ha = MHeap_Arena(runtime·mheap, obj);
+			off = ((uintptr)obj & (HeapArenaBytes-1)) / PtrSize;
+			bitp = (uintptr*)ha->bitmap + off/wordsPerBitmapWord;
 			shift = off % wordsPerBitmapWord;
 			xbits = *bitp;
 			bits = xbits >> shift;
@@ -496,21 +505,19 @@ flushptrbuf(PtrTarget *ptrbuf, PtrTarget **ptrbufpos, Obj **_wp, Workbuf **_wbuf
 			// Mark the block 否则要将块进行标记
 			*bt->bitp = xbits | (bitMarked << bt->shift);
 
-			// If object has no pointers, don't need to scan further.
-			/* 如果这个对象中不包含指针,则不会引用到其它对象.将它自身的垃圾回收位标上就可以了
-			   否则,还要将从它出去的指针放到work缓存中递归地进行标记
-			 */
-			if((bits & bitNoPointers) != 0)
-				continue;
-
 			obj = bt->p;
 
 			// Ask span about size class.
 			// (Manually inlined copy of MHeap_Lookup.)
-			x = (uintptr)obj >> PageShift;
-			if(sizeof(void*) == 8)
-				x -= (uintptr)arena_start>>PageShift;
-			s = runtime·mheap->map[x];
+			k = (uintptr)obj >> PageShift;
+			s = MHeap_Arena(runtime·mheap, obj)->spans[k & (PagesPerArena-1)];
+
+			// If the span has no pointers, don't need to scan further.
+			/* 如果span中的对象都不包含指针,则不会引用到其它对象.将它自身的垃圾回收位标上就可以了
+			   否则,还要将从它出去的指针放到work缓存中递归地进行标记
+			 */
+			if(SpanClass_NoScan(s->spanclass))
+				continue;
 
 			PREFETCH(obj);
 
@@ -1155,13 +1162,12 @@ debug_scanblock(byte *b, uintptr n)
 		} else {
 			if((byte*)obj >= (byte*)s->limit)
 				continue;
-			int32 i = ((byte*)obj - p)/size;
-			obj = p+i*size;/* 从字对齐地址找到obj对齐的地址 */
+			obj = p + MSpan_ObjIndex(s, (byte*)obj - p)*size;/* 从字对齐地址找到obj对齐的地址 */
 		}
 
 		// Now that we know the object header, reload bits.
-		off = (uintptr*)obj - (uintptr*)runtime·mheap->arena_start;
-		bitp = (uintptr*)runtime·mheap->arena_start - off/wordsPerBitmapWord - 1;
+		off = ((uintptr)obj & (HeapArenaBytes-1)) / PtrSize;
+		bitp = (uintptr*)MHeap_Arena(runtime·mheap, obj)->bitmap + off/wordsPerBitmapWord;
 		shift = off % wordsPerBitmapWord;
 		xbits = *bitp;
 		bits = xbits >> shift;
@@ -1176,7 +1182,7 @@ debug_scanblock(byte *b, uintptr n)
 			runtime·printf("found unmarked block %p in %p\n", obj, vp+i);
 
 		// If object has no pointers, don't need to scan further.
-		if((bits & bitNoPointers) != 0)
+		if(SpanClass_NoScan(s->spanclass))
 			continue;
 
 		debug_scanblock(obj, size);
@@ -1534,17 +1540,18 @@ handlespecial(byte *p, uintptr size)
 
 // Sweep frees or collects finalizers for blocks not marked in the mark phase.
 // It clears the mark bits in preparation for the next GC round.
+// For a small-object span, the surviving objects are recorded in the
+// span's mark bitmap, which then becomes its allocation bitmap;
+// the freed objects themselves are never written.
 static void
 sweepspan(ParFor *desc, uint32 idx)
 {
-	int32 cl, n, npages;
+	int32 cl, n, npages, i;
 	uintptr size;
 	byte *p;
 	MCache *c;
-	byte *arena_start;
-	MLink head, *end;
-	int32 nfree;
-	byte *type_data;
+	int32 nfree, nalloc;
+	byte *type_data, *markbits;
 	byte compression;
 	uintptr type_data_inc;
 	MSpan *s;
@@ -1553,7 +1560,6 @@ sweepspan(ParFor *desc, uint32 idx)
 	s = runtime·mheap->allspans[idx];
 	if(s->state != MSpanInUse)
 		return;
-	arena_start = runtime·mheap->arena_start;
 	p = (byte*)(s->start << PageShift);
 	cl = s->sizeclass;
 	size = s->elemsize;
@@ -1565,7 +1571,10 @@ sweepspan(ParFor *desc, uint32 idx)
 		n = (npages << PageShift) / size;
 	}
 	nfree = 0;
-	end = &head;
+	nalloc = 0;
+	markbits = MSpan_MarkBits(s);
+	if(cl != 0)
+		runtime·memclr(markbits, sizeof s->bits[0]);
 	c = m->mcache;
 	
 	type_data = (byte*)s->types.data;
@@ -1581,11 +1590,11 @@ sweepspan(ParFor *desc, uint32 idx)
 	// Sweep through n objects of given size starting at p.
 	// This thread owns the span now, so it can manipulate
 	// the block bitmap without atomic operations.
-	for(; n > 0; n--, p += size, type_data+=type_data_inc) {
+	for(i = 0; i < n; i++, p += size, type_data+=type_data_inc) {
 		uintptr off, *bitp, shift, bits;
 
-		off = (uintptr*)p - (uintptr*)arena_start;
-		bitp = (uintptr*)arena_start - off/wordsPerBitmapWord - 1;
+		off = ((uintptr)p & (HeapArenaBytes-1)) / PtrSize;
+		bitp = (uintptr*)MHeap_Arena(runtime·mheap, p)->bitmap + off/wordsPerBitmapWord;
 		shift = off % wordsPerBitmapWord;
 		bits = *bitp>>shift;
 
@@ -1599,6 +1608,8 @@ sweepspan(ParFor *desc, uint32 idx)
 				*bitp &= ~(bitSpecial<<shift);
 			}
 			*bitp &= ~(bitMarked<<shift);
+			markbits[i/8] |= 1<<(i%8);
+			nalloc++;
 			continue;
 		}
 
@@ -1606,8 +1617,11 @@ sweepspan(ParFor *desc, uint32 idx)
 		// In DebugMark mode, the bit has been coopted so
 		// we have to assume all blocks are special.
 		if(DebugMark || (bits & bitSpecial) != 0) {
-			if(handlespecial(p, size))
+			if(handlespecial(p, size)) {
+				markbits[i/8] |= 1<<(i%8);
+				nalloc++;
 				continue;
+			}
 		}
 
 		// Mark freed; restore block boundary bit.
@@ -1617,9 +1631,7 @@ sweepspan(ParFor *desc, uint32 idx)
 			// Free large span.
 			runtime·unmarkspan(p, 1<<PageShift);
 			*(uintptr*)p = 1;	// needs zeroing
-			runtime·MHeap_Free(runtime·mheap, s, 1);
-			c->local_alloc -= size;
-			c->local_nfree++;
+			runtime·MHeap_Free(runtime·mheap, s, 1);	// counts the free
 		} else {
 			// Free small object.
 			switch(compression) {
@@ -1630,23 +1642,29 @@ sweepspan(ParFor *desc, uint32 idx)
 				*(byte*)type_data = 0;
 				break;
 			}
-			if(size > sizeof(uintptr))
-				((uintptr*)p)[1] = 1;	// mark as "needs to be zeroed"
-			
-			end->next = (MLink*)p;
-			end = (MLink*)p;
 			nfree++;
 		}
 	}
 
+	if(cl == 0)
+		return;
+
 	if(nfree) {
 		c->local_by_size[cl].nfree += nfree;
 		c->local_alloc -= size * nfree;
 		c->local_nfree += nfree;
 		c->local_cachealloc -= nfree * size;
 		c->local_objects -= nfree;
-		runtime·MCentral_FreeSpan(&runtime·mheap->central[cl], s, nfree, head.next, end);
+		s->needzero = 1;
 	}
+
+	// The marks are the new allocation bitmap.  Objects freed
+	// explicitly since the last sweep are not allocated in the
+	// heap bitmap, so they come back here as well.
+	s->allocidx ^= 1;
+	runtime·MSpan_InitAlloc(s, s->nelems);
+	s->ref = nalloc;
+	runtime·MCentral_FreeSpan(&runtime·mheap->central[s->spanclass], s);
 }
 
 static void
@@ -1655,14 +1673,12 @@ dumpspan(uint32 idx)
 	int32 sizeclass, n, npages, i, column;
 	uintptr size;
 	byte *p;
-	byte *arena_start;
 	MSpan *s;
 	bool allocated, special;
 
 	s = runtime·mheap->allspans[idx];
 	if(s->state != MSpanInUse)
 		return;
-	arena_start = runtime·mheap->arena_start;
 	p = (byte*)(s->start << PageShift);
 	sizeclass = s->sizeclass;
 	size = s->elemsize;
@@ -1678,8 +1694,8 @@ dumpspan(uint32 idx)
 	for(; n>0; n--, p+=size) {
 		uintptr off, *bitp, shift, bits;
 
-		off = (uintptr*)p - (uintptr*)arena_start;
-		bitp = (uintptr*)arena_start - off/wordsPerBitmapWord - 1;
+		off = ((uintptr)p & (HeapArenaBytes-1)) / PtrSize;
+		bitp = (uintptr*)MHeap_Arena(runtime·mheap, p)->bitmap + off/wordsPerBitmapWord;
 		shift = off % wordsPerBitmapWord;
 		bits = *bitp>>shift;
 
@@ -1758,14 +1774,36 @@ runtime·gchelper(void)
 // extra memory used).
 static int32 gcpercent = GcpercentUnknown;
 
+// The soft memory limit, initialized from $GOMEMLIMIT (megabytes;
+// unset or "off" means none) and set by debug.SetMemoryLimit.
+//
+// Near the limit, the next gc comes sooner than gcpercent says:
+// early enough that the heap's memory plus the rest of what the
+// runtime holds from the operating system (stacks, span and cache
+// structures, profiling buckets) stays within the limit.  It is a
+// soft limit because of two guards against a death spiral, in which
+// the live heap alone nearly fills the limit and the program does
+// little but collect: the heap may always grow by LimitMinGrowth
+// since the last gc, and once collections take more than
+// LimitMaxGCPercent of the time on average, the limit is ignored
+// until they take less.
+enum
+{
+	LimitMinGrowth = 16,	// heap may grow by at least heap_alloc/16
+	LimitMaxGCPercent = 50,	// of wall time spent stopped for gc
+};
+int64 runtime·gcmemlimit = GcpercentUnknown;	// -1 means no limit
+static int64 gcpausefrac;	// percent of time in gc, moving average
+static int64 lastgcend;	// runtime·nanotime at end of last gc
+
 static void
 cachestats(GCStats *stats)
 {
 	M *mp;
 	MCache *c;
 	P *p, **pp;
-	int32 i;
-	uint64 stacks_inuse;
+	int32 i, j;
+	uint64 stacks_inuse, held;
 	uint64 *src, *dst;
 
 	if(stats)
@@ -1781,19 +1819,38 @@ cachestats(GCStats *stats)
 			runtime·memclr((byte*)&mp->gcstats, sizeof(mp->gcstats));
 		}
 	}
+	held = 0;
 	for(pp=runtime·allp; p=*pp; pp++) {
 		c = p->mcache;
 		if(c==nil)
 			continue;
+		held += c->size;
+		if(c->pagechunk != nil)
+			held += c->pagechunk->npages<<PageShift;
 		runtime·purgecachedstats(c);
 		for(i=0; i<nelem(c->local_by_size); i++) {
 			mstats.by_size[i].nmalloc += c->local_by_size[i].nmalloc;
 			c->local_by_size[i].nmalloc = 0;
 			mstats.by_size[i].nfree += c->local_by_size[i].nfree;
 			c->local_by_size[i].nfree = 0;
+			runtime·allocstats.by_size[i].nrefill += c->local_by_size[i].nrefill;
+			c->local_by_size[i].nrefill = 0;
+			runtime·allocstats.by_size[i].ngrow += c->local_by_size[i].ngrow;
+			c->local_by_size[i].ngrow = 0;
+		}
+		for(i=0; i<NumAllocTiers; i++) {
+			for(j=0; j<NumLatencyBuckets; j++) {
+				runtime·allocstats.alloclatency[i][j] += c->local_alloclatency[i][j];
+				c->local_alloclatency[i][j] = 0;
+			}
+		}
+		for(i=0; i<NumSizeBuckets; i++) {
+			runtime·sizehist[i] += c->local_sizehist[i];
+			c->local_sizehist[i] = 0;
 		}
 	}
 	mstats.stacks_inuse = stacks_inuse;
+	runtime·allocstats.mcache_held = held;
 }
 
 // Structure of arguments passed to function gc().
@@ -1805,6 +1862,57 @@ struct gc_args
 
 static void gc(struct gc_args *args);
 
+// Memory the runtime holds from the operating system
+// other than for the heap.
+uint64
+runtime·nonheapsys(void)
+{
+	return mstats.stacks_sys + mstats.mspan_sys + mstats.mcache_sys + mstats.buckhash_sys;
+}
+
+static int64
+readmemlimit(void)
+{
+	byte *p;
+
+	p = runtime·getenv("GOMEMLIMIT");
+	if(p == nil || p[0] == '\0' || runtime·strcmp(p, (byte*)"off") == 0)
+		return -1;
+	return (int64)runtime·atoi(p) << 20;
+}
+
+// Set mstats.next_gc at the end of a gc that stopped the world
+// for pause ns, starting period ns after the previous one ended.
+static void
+setnextgc(int64 pause, int64 period)
+{
+	uint64 other, goal, floor;
+
+	mstats.next_gc = mstats.heap_alloc+mstats.heap_alloc*gcpercent/100;
+	if(runtime·gcmemlimit < 0)
+		return;
+
+	// Share of the time from the end of the last gc
+	// to the end of this one spent stopped for it.
+	if(pause+period > 0)
+		gcpausefrac = (gcpausefrac*3 + pause*100/(pause+period))/4;
+	if(gcpausefrac > LimitMaxGCPercent)
+		return;
+
+	// Memory not in use by heap objects counts against the
+	// limit too: idle and fragmented heap pages, not yet
+	// released, and the runtime's other memory.
+	other = mstats.heap_sys - mstats.heap_released - mstats.heap_alloc + runtime·nonheapsys();
+	goal = 0;
+	if((uint64)runtime·gcmemlimit > other)
+		goal = runtime·gcmemlimit - other;
+	floor = mstats.heap_alloc + mstats.heap_alloc/LimitMinGrowth;
+	if(goal < floor)
+		goal = floor;
+	if(goal < mstats.next_gc)
+		mstats.next_gc = goal;
+}
+
 static int32
 readgogc(void)
 {
@@ -1844,6 +1952,17 @@ runtime·gc(int32 force)
 
 	if(gcpercent == GcpercentUnknown) {	// first time through
 		gcpercent = readgogc();
+		if(runtime·gcmemlimit == GcpercentUnknown)
+			runtime·gcmemlimit = readmemlimit();
+		p = runtime·getenv("GOHEAPHINT");
+		if(p != nil)
+			runtime·heaphint = (uint64)runtime·atoi(p) << 20;
+		// Put off the first collection until the heap
+		// reaches the hint, but not past the soft limit.
+		if(runtime·gcmemlimit >= 0 && runtime·heaphint > runtime·gcmemlimit)
+			runtime·heaphint = runtime·gcmemlimit;
+		if(runtime·heaphint > mstats.next_gc)
+			mstats.next_gc = runtime·heaphint;
 
 		p = runtime·getenv("GOGCTRACE");
 		if(p != nil)
@@ -1875,6 +1994,7 @@ gc(struct gc_args *args)
 	uint64 heap0, heap1, obj0, obj1, ninstr;
 	GCStats stats;
 	M *mp;
+	P *p, **pp;
 	uint32 i;
 	Eface eface;
 
@@ -1923,6 +2043,24 @@ gc(struct gc_args *args)
 	work.ndone = 0;
 	work.debugmarkdone = 0;
 	work.nproc = runtime·gcprocs();
+
+	// Sweep rebuilds the allocation bitmaps of small-object spans,
+	// so take back the spans cached by every P before any helper
+	// can start sweeping.  Nothing allocates from here to the end
+	// of the sweep, which puts every small-object span that still
+	// has free slots back into its MCentral's emptied set.
+	// Empty the pools too, before marking, so that pooled
+	// objects not in use die in this cycle.
+	for(pp=runtime·allp; p=*pp; pp++) {
+		if(p->mcache != nil) {
+			runtime·MCache_ReleaseAll(p->mcache);
+			runtime·MCache_ClearPools(p->mcache);
+		}
+	}
+	runtime·clearpools();
+	for(i=0; i<NumSpanClasses; i++)
+		runtime·MCentral_ResetSets(&runtime·mheap->central[i]);
+
 	//添加垃圾回收的roots
 	addroots();
 	//设置并行任务，它们被启动后分别会运行markroot和sweepspan
@@ -1959,7 +2097,7 @@ gc(struct gc_args *args)
 	stats.nosyield += work.sweepfor->nosyield;
 	stats.nsleep += work.sweepfor->nsleep;
 
-	mstats.next_gc = mstats.heap_alloc+mstats.heap_alloc*gcpercent/100;
+	setnextgc(runtime·nanotime() - t0, t0 - lastgcend);
 	m->gcing = 0;
 
 	if(finq != nil) {
@@ -1978,6 +2116,7 @@ gc(struct gc_args *args)
 	obj1 = mstats.nmalloc - mstats.nfree;
 
 	t4 = runtime·nanotime();
+	lastgcend = t4;
 	mstats.last_gc = t4;
 	mstats.pause_ns[mstats.numgc%nelem(mstats.pause_ns)] = t4 - t0;
 	mstats.pause_total_ns += t4 - t0;
@@ -2026,21 +2165,111 @@ gc(struct gc_args *args)
 		runtime·gosched();
 }
 
+// Add the counters c has not purged into mstats and allocstats
+// yet to *stats and *astats, either of which may be nil, while
+// c's owner may be updating them (see MCache.statsseq).  The heap
+// must be locked, so that purgecachedstats cannot move counts
+// from c in between.
+static void
+readcachestats(MCache *c, MStats *stats, MAllocStats *astats)
+{
+	uint32 seq;
+	int32 i, j;
+	int64 cachealloc, objects, alloc, total_alloc, nmalloc, nfree, nlookup, hit, miss;
+	struct {
+		int64 nmalloc;
+		int64 nfree;
+		int64 nrefill;
+		int64 ngrow;
+	} by_size[NumSizeClasses];
+	int64 latency[NumAllocTiers][NumLatencyBuckets];
+
+	for(;;) {
+		seq = runtime·atomicload(&c->statsseq);
+		if(seq & 1) {
+			runtime·osyield();
+			continue;
+		}
+		cachealloc = c->local_cachealloc;
+		objects = c->local_objects;
+		alloc = c->local_alloc;
+		total_alloc = c->local_total_alloc;
+		nmalloc = c->local_nmalloc;
+		nfree = c->local_nfree;
+		nlookup = c->local_nlookup;
+		hit = c->local_pagecache_hit;
+		miss = c->local_pagecache_miss;
+		runtime·memmove(by_size, c->local_by_size, sizeof by_size);
+		runtime·memmove(latency, c->local_alloclatency, sizeof latency);
+		if(runtime·atomicload(&c->statsseq) == seq)
+			break;
+	}
+	if(stats != nil) {
+		stats->heap_alloc += cachealloc;
+		stats->heap_objects += objects;
+		stats->alloc += alloc;
+		stats->total_alloc += total_alloc;
+		stats->nmalloc += nmalloc;
+		stats->nfree += nfree;
+		stats->nlookup += nlookup;
+		for(i=0; i<NumSizeClasses; i++) {
+			stats->by_size[i].nmalloc += by_size[i].nmalloc;
+			stats->by_size[i].nfree += by_size[i].nfree;
+		}
+	}
+	if(astats != nil) {
+		astats->pagecache_hit += hit;
+		astats->pagecache_miss += miss;
+		for(i=0; i<NumSizeClasses; i++) {
+			astats->by_size[i].nrefill += by_size[i].nrefill;
+			astats->by_size[i].ngrow += by_size[i].ngrow;
+		}
+		for(i=0; i<NumAllocTiers; i++)
+			for(j=0; j<NumLatencyBuckets; j++)
+				astats->alloclatency[i][j] += latency[i][j];
+	}
+}
+
+// Take mstats and allocstats under the heap lock and add what
+// each P's cache has not purged into them yet.  The result is a
+// consistent snapshot, except that mcache_held is as of the last
+// collection.
+static void
+readstats(MStats *stats, MAllocStats *astats)
+{
+	P *p, **pp;
+
+	runtime·lock(runtime·mheap);
+	if(stats != nil)
+		*stats = mstats;
+	if(astats != nil)
+		*astats = runtime·allocstats;
+	for(pp=runtime·allp; p=*pp; pp++) {
+		if(p->mcache != nil)
+			readcachestats(p->mcache, stats, astats);
+	}
+	runtime·unlock(runtime·mheap);
+}
+
+// Read the statistics without stopping the world (see readstats).
 void
 runtime·ReadMemStats(MStats *stats)
 {
-	// Have to acquire worldsema to stop the world,
-	// because stoptheworld can only be used by
-	// one goroutine at a time, and there might be
-	// a pending garbage collection already calling it.
-	runtime·semacquire(&runtime·worldsema);
-	m->gcing = 1;
-	runtime·stoptheworld();
-	cachestats(nil);
-	*stats = mstats;
-	m->gcing = 0;
-	runtime·semrelease(&runtime·worldsema);
-	runtime·starttheworld();
+	M *mp;
+	uint64 stacks_inuse;
+
+	readstats(stats, nil);
+	stacks_inuse = 0;
+	for(mp=runtime·allm; mp; mp=mp->alllink)
+		stacks_inuse += mp->stackinuse*FixedStack;
+	stats->stacks_inuse = stacks_inuse;
+}
+
+// Read the runtime-only statistics without stopping the world.
+void
+runtime·ReadAllocStats(MAllocStats *stats)
+{
+	readstats(nil, stats);
 }
 
 void
@@ -2088,6 +2317,22 @@ runtime∕debug·setGCPercent(intgo in, intgo out)
 	FLUSH(&out);
 }
 
+// Set the soft memory limit to in bytes, or none if in < 0,
+// returning the previous setting.  Takes effect at the next gc.
+void
+runtime∕debug·setMemoryLimit(int64 in, int64 out)
+{
+	runtime·lock(runtime·mheap);
+	if(runtime·gcmemlimit == GcpercentUnknown)
+		runtime·gcmemlimit = readmemlimit();
+	out = runtime·gcmemlimit;
+	if(in < 0)
+		in = -1;
+	runtime·gcmemlimit = in;
+	runtime·unlock(runtime·mheap);
+	FLUSH(&out);
+}
+
 static void
 runfinq(void)
 {
@@ -2140,27 +2385,27 @@ runfinq(void)
 // mark the block at v of size n as allocated.
 // If noptr is true, mark it as having no pointers.
 void
-runtime·markallocated(void *v, uintptr n, bool noptr)
+runtime·markallocated(void *v, uintptr n)
 {
 	uintptr *b, obits, bits, off, shift;
+	MHeapArena *ha;
 
 	if(0)
 		runtime·printf("markallocated %p+%p\n", v, n);
-	/* 确定在这个区域之内 */
-	if((byte*)v+n > (byte*)runtime·mheap->arena_used || (byte*)v < runtime·mheap->arena_start)
+	/* 确定在堆的arena之内 */
+	ha = runtime·MHeap_ArenaOf(runtime·mheap, v);
+	if(ha == nil || (byte*)v+n > (byte*)runtime·mheap->arena_used)
 		runtime·throw("markallocated: bad pointer");
 	/*计算偏移 */
-	off = (uintptr*)v - (uintptr*)runtime·mheap->arena_start;  // word offset
+	off = ((uintptr)v & (HeapArenaBytes-1)) / PtrSize;  // word offset
 	/* 根据偏移找到标记位图 */
-	b = (uintptr*)runtime·mheap->arena_start - off/wordsPerBitmapWord - 1;
+	b = (uintptr*)ha->bitmap + off/wordsPerBitmapWord;
 	shift = off % wordsPerBitmapWord;
 
 	/* 将对应的位全部加上标记 */
 	for(;;) {
 		obits = *b;
 		bits = (obits & ~(bitMask<<shift)) | (bitAllocated<<shift);
-		if(noptr)
-			bits |= bitNoPointers<<shift;
 		if(runtime·singleproc) {
 			*b = bits;
 			break;
@@ -2172,20 +2417,67 @@ runtime·markallocated(void *v, uintptr n, bool noptr)
 	}
 }
 
+// mark the nv blocks at v[0:nv], each of size n, as allocated.
+// Consecutive blocks whose bits share a bitmap word, as the runs
+// MCache_AllocN takes from one span mostly do, are marked with a
+// single update of that word.
+void
+runtime·markallocatedbatch(void **v, uintptr nv, uintptr n)
+{
+	uintptr *b, obits, bits, mask, set, off, shift, word, i, j;
+	MHeapArena *ha;
+
+	for(i=0; i<nv; i=j) {
+		ha = runtime·MHeap_ArenaOf(runtime·mheap, v[i]);
+		if(ha == nil)
+			runtime·throw("markallocated: bad pointer");
+		off = ((uintptr)v[i] & (HeapArenaBytes-1)) / PtrSize;  // word offset
+		b = (uintptr*)ha->bitmap + off/wordsPerBitmapWord;
+
+		// Arenas are aligned, so blocks in the same bitmap word
+		// are in the same arena.
+		word = (uintptr)v[i] / (PtrSize*wordsPerBitmapWord);
+		mask = 0;
+		set = 0;
+		for(j=i; j<nv && (uintptr)v[j] / (PtrSize*wordsPerBitmapWord) == word; j++) {
+			if((byte*)v[j]+n > (byte*)runtime·mheap->arena_used)
+				runtime·throw("markallocated: bad pointer");
+			shift = ((uintptr)v[j] / PtrSize) % wordsPerBitmapWord;
+			mask |= bitMask<<shift;
+			set |= bitAllocated<<shift;
+		}
+
+		for(;;) {
+			obits = *b;
+			bits = (obits & ~mask) | set;
+			if(runtime·singleproc) {
+				*b = bits;
+				break;
+			} else {
+				// more than one goroutine is potentially running: use atomic op
+				if(runtime·casp((void**)b, (void*)obits, (void*)bits))
+					break;
+			}
+		}
+	}
+}
+
 // mark the block at v of size n as freed.
 void
 runtime·markfreed(void *v, uintptr n)
 {
 	uintptr *b, obits, bits, off, shift;
+	MHeapArena *ha;
 
 	if(0)
 		runtime·printf("markallocated %p+%p\n", v, n);
 
-	if((byte*)v+n > (byte*)runtime·mheap->arena_used || (byte*)v < runtime·mheap->arena_start)
+	ha = runtime·MHeap_ArenaOf(runtime·mheap, v);
+	if(ha == nil || (byte*)v+n > (byte*)runtime·mheap->arena_used)
 		runtime·throw("markallocated: bad pointer");
 
-	off = (uintptr*)v - (uintptr*)runtime·mheap->arena_start;  // word offset
-	b = (uintptr*)runtime·mheap->arena_start - off/wordsPerBitmapWord - 1;
+	off = ((uintptr)v & (HeapArenaBytes-1)) / PtrSize;  // word offset
+	b = (uintptr*)ha->bitmap + off/wordsPerBitmapWord;
 	shift = off % wordsPerBitmapWord;
 
 	for(;;) {
@@ -2207,15 +2499,17 @@ void
 runtime·checkfreed(void *v, uintptr n)
 {
 	uintptr *b, bits, off, shift;
+	MHeapArena *ha;
 
 	if(!runtime·checking)
 		return;
 
-	if((byte*)v+n > (byte*)runtime·mheap->arena_used || (byte*)v < runtime·mheap->arena_start)
+	ha = runtime·MHeap_ArenaOf(runtime·mheap, v);
+	if(ha == nil || (byte*)v+n > (byte*)runtime·mheap->arena_used)
 		return;	// not allocated, so okay
 
-	off = (uintptr*)v - (uintptr*)runtime·mheap->arena_start;  // word offset
-	b = (uintptr*)runtime·mheap->arena_start - off/wordsPerBitmapWord - 1;
+	off = ((uintptr)v & (HeapArenaBytes-1)) / PtrSize;  // word offset
+	b = (uintptr*)ha->bitmap + off/wordsPerBitmapWord;
 	shift = off % wordsPerBitmapWord;
 
 	bits = *b>>shift;
@@ -2234,7 +2528,7 @@ runtime·markspan(void *v, uintptr size, uintptr n, bool leftover)
 	uintptr *b, off, shift;
 	byte *p;
 
-	if((byte*)v+size*n > (byte*)runtime·mheap->arena_used || (byte*)v < runtime·mheap->arena_start)
+	if(runtime·MHeap_ArenaOf(runtime·mheap, v) == nil || (byte*)v+size*n > (byte*)runtime·mheap->arena_used)
 		runtime·throw("markspan: bad pointer");
 
 	p = v;
@@ -2245,8 +2539,8 @@ runtime·markspan(void *v, uintptr size, uintptr n, bool leftover)
 		// the entire span, and each bitmap word has bits for only
 		// one span, so no other goroutines are changing these
 		// bitmap words.
-		off = (uintptr*)p - (uintptr*)runtime·mheap->arena_start;  // word offset
-		b = (uintptr*)runtime·mheap->arena_start - off/wordsPerBitmapWord - 1;
+		off = ((uintptr)p & (HeapArenaBytes-1)) / PtrSize;  // word offset
+		b = (uintptr*)MHeap_Arena(runtime·mheap, p)->bitmap + off/wordsPerBitmapWord;
 		shift = off % wordsPerBitmapWord;
 		*b = (*b & ~(bitMask<<shift)) | (bitBlockBoundary<<shift);
 	}
@@ -2256,26 +2550,33 @@ runtime·markspan(void *v, uintptr size, uintptr n, bool leftover)
 void
 runtime·unmarkspan(void *v, uintptr n)
 {
-	uintptr *p, *b, off;
+	uintptr *b, off, chunk;
+	byte *p;
 
-	if((byte*)v+n > (byte*)runtime·mheap->arena_used || (byte*)v < runtime·mheap->arena_start)
+	if(runtime·MHeap_ArenaOf(runtime·mheap, v) == nil || (byte*)v+n > (byte*)runtime·mheap->arena_used)
 		runtime·throw("markspan: bad pointer");
 
 	p = v;
-	off = p - (uintptr*)runtime·mheap->arena_start;  // word offset
+	off = ((uintptr)p & (HeapArenaBytes-1)) / PtrSize;  // word offset
 	if(off % wordsPerBitmapWord != 0)
 		runtime·throw("markspan: unaligned pointer");
-	b = (uintptr*)runtime·mheap->arena_start - off/wordsPerBitmapWord - 1;
-	n /= PtrSize;
-	if(n%wordsPerBitmapWord != 0)
+	if(n/PtrSize % wordsPerBitmapWord != 0)
 		runtime·throw("unmarkspan: unaligned length");
 	// Okay to use non-atomic ops here, because we control
 	// the entire span, and each bitmap word has bits for only
 	// one span, so no other goroutines are changing these
 	// bitmap words.
-	n /= wordsPerBitmapWord;
-	while(n-- > 0)
-		*b-- = 0;
+	// A large span can cover several arenas; clear each one's part.
+	while(n > 0) {
+		off = ((uintptr)p & (HeapArenaBytes-1)) / PtrSize;
+		b = (uintptr*)MHeap_Arena(runtime·mheap, p)->bitmap + off/wordsPerBitmapWord;
+		chunk = HeapArenaBytes - ((uintptr)p & (HeapArenaBytes-1));
+		if(chunk > n)
+			chunk = n;
+		runtime·memclr((byte*)b, chunk/PtrSize/wordsPerBitmapWord*sizeof *b);
+		p += chunk;
+		n -= chunk;
+	}
 }
 
 bool
@@ -2286,8 +2587,8 @@ runtime·blockspecial(void *v)
 	if(DebugMark)
 		return true;
 
-	off = (uintptr*)v - (uintptr*)runtime·mheap->arena_start;
-	b = (uintptr*)runtime·mheap->arena_start - off/wordsPerBitmapWord - 1;
+	off = ((uintptr)v & (HeapArenaBytes-1)) / PtrSize;
+	b = (uintptr*)MHeap_Arena(runtime·mheap, v)->bitmap + off/wordsPerBitmapWord;
 	shift = off % wordsPerBitmapWord;
 
 	return (*b & (bitSpecial<<shift)) != 0;
@@ -2301,8 +2602,8 @@ runtime·setblockspecial(void *v, bool s)
 	if(DebugMark)
 		return;
 
-	off = (uintptr*)v - (uintptr*)runtime·mheap->arena_start;
-	b = (uintptr*)runtime·mheap->arena_start - off/wordsPerBitmapWord - 1;
+	off = ((uintptr)v & (HeapArenaBytes-1)) / PtrSize;
+	b = (uintptr*)MHeap_Arena(runtime·mheap, v)->bitmap + off/wordsPerBitmapWord;
 	shift = off % wordsPerBitmapWord;
 
 	for(;;) {
@@ -2321,23 +2622,3 @@ runtime·setblockspecial(void *v, bool s)
 		}
 	}
 }
-
-void
-runtime·MHeap_MapBits(MHeap *h)
-{
-	// Caller has added extra mappings to the arena.
-	// Add extra mappings of bitmap words as needed.
-	// We allocate extra bitmap pieces in chunks of bitmapChunk.
-	enum {
-		bitmapChunk = 8192
-	};
-	uintptr n;
-
-	n = (h->arena_used - h->arena_start) / wordsPerBitmapWord;
-	n = (n+bitmapChunk-1) & ~(bitmapChunk-1);
-	if(h->bitmap_mapped >= n)
-		return;
-
-	runtime·SysMap(h->arena_start - n, n - h->bitmap_mapped);
-	h->bitmap_mapped = n;
-}
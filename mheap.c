@@ -0,0 +1,1412 @@
+// Copyright 2009 The Go Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Page heap.
+//
+// See malloc.h for overview.
+//
+// When a MSpan is in the heap free list, state == MSpanFree.
+// When a MSpan is allocated, state == MSpanInUse.
+// Either way spanof(i) == span for all s->start <= i < s->start+s->npages,
+// so no entry ever points at a dead MSpan, and spanalloc can give
+// the slabs of dead ones back to the operating system.
+//
+// spanof(i) is the entry for page i in its arena's MHeapArena.spans.
+//
+// Free spans shorter than MaxMHeapList pages are on the exact-size
+// lists h->free[npages].  Longer ones are in h->large, a treap
+// (a binary search tree that is also a heap on random priorities,
+// which keeps it balanced in expectation) ordered by (npages, start),
+// so best fit is a single O(log n) descent.
+//
+// In huge page mode ($GOHUGEPAGES=1, runtime·hugepages), the heap
+// grows in whole transparent huge pages, large spans of a huge page
+// or more start on a huge page boundary, and the scavenger releases
+// only whole huge pages, so that it never splits one the heap is
+// still using.
+
+#include "runtime.h"
+#include "arch_GOARCH.h"
+#include "malloc.h"
+
+static MSpan *MHeap_AllocLocked(MHeap*, uintptr, int32, uintptr*);
+static MSpan *MHeap_AllocSpanLocked(MHeap*, MSpan*, uintptr, int32, uintptr*);
+static MSpan *MHeap_AllocHuge(MHeap*, uintptr, int32);
+static void MHeap_TrimLocked(MHeap*, MSpan*, uintptr, uintptr);
+static bool MHeap_Grow(MHeap*, uintptr);
+static void MHeap_FreeLocked(MHeap*, MSpan*);
+static void MHeap_FreePagesLocked(MHeap*, PageID, uintptr, uintptr);
+static MSpan *MHeap_Coalesce(MHeap*, MSpan*, MSpan*);
+static MSpan *MHeap_AllocLarge(MHeap*, uintptr);
+static void MHeap_InsertFree(MHeap*, MSpan*);
+static void MHeap_RemoveFree(MHeap*, MSpan*);
+
+int32 runtime·hugepages;
+
+// Span recorded for page p, or nil if p is in no heap arena.
+static MSpan*
+spanof(MHeap *h, PageID p)
+{
+	MHeapArena *ha;
+
+	ha = runtime·MHeap_ArenaOf(h, (void*)(p<<PageShift));
+	if(ha == nil)
+		return nil;
+	return ha->spans[p & (PagesPerArena-1)];
+}
+
+// Record s as the span of page p, which must be heap memory.
+static void
+setspan(MHeap *h, PageID p, MSpan *s)
+{
+	MHeap_Arena(h, p<<PageShift)->spans[p & (PagesPerArena-1)] = s;
+}
+
+// Called by spanalloc the first time it hands out the MSpan at p.
+static void
+RecordSpan(void *vh, byte *p)
+{
+	MHeap *h;
+	MSpan *s;
+	MSpan **all;
+	uint32 cap;
+
+	h = vh;
+	s = (MSpan*)p;
+	s->state = MSpanDead;	// the sweeper skips it until it is initialized
+	if(h->nspan >= h->nspancap) {
+		cap = 64*1024/sizeof(all[0]);
+		if(cap < h->nspancap*3/2)
+			cap = h->nspancap*3/2;
+		all = (MSpan**)runtime·SysAlloc(cap*sizeof(all[0]));
+		if(all == nil)
+			runtime·throw("runtime: cannot allocate memory");
+		if(h->allspans) {
+			runtime·memmove(all, h->allspans, h->nspancap*sizeof(all[0]));
+			runtime·SysFree(h->allspans, h->nspancap*sizeof(all[0]));
+		}
+		h->allspans = all;
+		h->nspancap = cap;
+	}
+	h->allspans[h->nspan++] = s;
+}
+
+// Called by spanalloc before it gives the slab holding the MSpans
+// in [lo, hi) back to the operating system.  They are all dead;
+// drop them from h->allspans.
+static void
+UnrecordSpans(void *vh, byte *lo, byte *hi)
+{
+	MHeap *h;
+	MSpan *s;
+	uint32 i, n;
+
+	h = vh;
+	n = 0;
+	for(i=0; i<h->nspan; i++) {
+		s = h->allspans[i];
+		if((byte*)s >= lo && (byte*)s < hi) {
+			if(s->state != MSpanDead)
+				runtime·throw("UnrecordSpans: span not dead");
+			continue;
+		}
+		h->allspans[n++] = s;
+	}
+	h->nspan = n;
+}
+
+// Initialize the heap.
+void
+runtime·MHeap_Init(MHeap *h)
+{
+	uint32 i;
+
+	runtime·SlabAlloc_Init(&h->spanalloc, sizeof(MSpan), RecordSpan, UnrecordSpans, h);
+	runtime·SlabAlloc_Init(&h->cachealloc, sizeof(MCache), nil, nil, nil);
+	// h->arenas needs no init
+	h->growchunk = HeapAllocChunk;
+	runtime·allocstats.heap_growchunk = h->growchunk;
+	for(i=0; i<nelem(h->free); i++)
+		runtime·MSpanList_Init(&h->free[i]);
+	// h->large needs no init
+	for(i=0; i<nelem(h->central); i++)
+		runtime·MCentral_Init(&h->central[i], i);
+}
+
+// Allocate a new span of npage pages from the heap
+// and record it in the span index.  If acct is set,
+// count the span in mstats as an allocated object.
+MSpan*
+runtime·MHeap_Alloc(MHeap *h, uintptr npage, int32 spanclass, int32 acct, int32 zeroed)
+{
+	MSpan *s;
+	int64 t0;
+
+	t0 = runtime·nanotime();
+	runtime·lock(h);
+	runtime·purgecachedstats(m->mcache);
+	if(runtime·hugepages && SpanClass_SizeClass(spanclass) == 0 && npage >= HugePagePages)
+		s = MHeap_AllocHuge(h, npage, spanclass);
+	else
+		s = MHeap_AllocLocked(h, npage, spanclass, nil);
+	if(s != nil) {
+		mstats.heap_inuse += npage<<PageShift;
+		if(acct) {
+			mstats.heap_objects++;
+			mstats.heap_alloc += npage<<PageShift;
+			mstats.nmalloc++;
+			mstats.alloc += npage<<PageShift;
+			mstats.total_alloc += npage<<PageShift;
+		}
+	}
+	runtime·unlock(h);
+	if(s != nil && *(uintptr*)(s->start<<PageShift) != 0 && zeroed)
+		runtime·memclr((byte*)(s->start<<PageShift), s->npages<<PageShift);
+	runtime·MCache_Latency(m->mcache, AllocTierHeap, t0);
+	return s;
+}
+
+// Allocate up to n spans of npage pages each for small objects,
+// locking the heap once for all of them.  Returns the number
+// allocated, which is less than n only if out of memory.
+int32
+runtime·MHeap_AllocSpans(MHeap *h, uintptr npage, int32 spanclass, int32 zeroed, MSpan **spans, int32 n)
+{
+	MSpan *s;
+	int32 i, j;
+	int64 t0;
+
+	t0 = runtime·nanotime();
+	runtime·lock(h);
+	runtime·purgecachedstats(m->mcache);
+	for(i=0; i<n; i++) {
+		s = MHeap_AllocLocked(h, npage, spanclass, nil);
+		if(s == nil)
+			break;
+		mstats.heap_inuse += npage<<PageShift;
+		spans[i] = s;
+	}
+	runtime·unlock(h);
+	for(j=0; j<i && zeroed; j++) {
+		s = spans[j];
+		if(*(uintptr*)(s->start<<PageShift) != 0)
+			runtime·memclr((byte*)(s->start<<PageShift), s->npages<<PageShift);
+	}
+	runtime·MCache_Latency(m->mcache, AllocTierHeap, t0);
+	return i;
+}
+
+// Allocate a span of npage pages with the heap locked.  If
+// npreleased is not nil, *npreleased is set to the number of
+// those pages that were released to the operating system.
+static MSpan*
+MHeap_AllocLocked(MHeap *h, uintptr npage, int32 spanclass, uintptr *npreleased)
+{
+	uintptr n;
+	MSpan *s;
+
+	// Try in fixed-size lists up to max.
+	for(n=npage; n < nelem(h->free); n++) {
+		if(!runtime·MSpanList_IsEmpty(&h->free[n])) {
+			s = h->free[n].next;
+			goto HaveSpan;
+		}
+	}
+
+	// Best fit in treap of large spans.
+	if((s = MHeap_AllocLarge(h, npage)) == nil) {
+		if(!MHeap_Grow(h, npage))
+			return nil;
+		if((s = MHeap_AllocLarge(h, npage)) == nil)
+			return nil;
+	}
+
+HaveSpan:
+	return MHeap_AllocSpanLocked(h, s, npage, spanclass, npreleased);
+}
+
+// Allocate the first npage pages of free span s, as for
+// MHeap_AllocLocked.
+static MSpan*
+MHeap_AllocSpanLocked(MHeap *h, MSpan *s, uintptr npage, int32 spanclass, uintptr *npreleased)
+{
+	int32 sizeclass;
+	uintptr n, released;
+	MSpan *t;
+
+	// Mark span in use.
+	if(s->state != MSpanFree)
+		runtime·throw("MHeap_AllocLocked - MSpan not free");
+	if(s->npages < npage)
+		runtime·throw("MHeap_AllocLocked - bad npages");
+	MHeap_RemoveFree(h, s);
+	mstats.heap_idle -= s->npages<<PageShift;
+	// s does not record where its released pages are, so charge
+	// the pages taken with their share of them and leave the
+	// rest, still released, with what remains of s.
+	released = s->npreleased;
+	if(s->npages > npage)
+		released = s->npreleased * npage / s->npages;
+	mstats.heap_released -= released<<PageShift;
+	if(npreleased != nil)
+		*npreleased = released;
+	if(s->npreleased > 0) {
+		if(runtime·hugepages)
+			runtime·SysUsed((void*)(s->start<<PageShift), npage<<PageShift);
+		// We have called runtime·SysUnused with these pages, and on
+		// Unix systems it called madvise.  At this point at least
+		// some BSD-based kernels will return these pages either as
+		// zeros or with the old data.  For our caller, the first word
+		// in the page indicates whether the span contains zeros or
+		// not (this word was set when the span was freed by
+		// runtime·MCentral_FreeSpan).  If the first page in the span
+		// is returned as zeros, and some subsequent page is returned
+		// with the old data, then we will be returning a span that is
+		// assumed to be all zeros, but the actual data will not be all
+		// zeros.  Avoid that problem by explicitly marking the span as
+		// not being zeroed, just in case.  The beadbead constant we use
+		// here means nothing, it is just a unique constant not seen
+		// elsewhere in the runtime, as a clue in case it turns up
+		// unexpectedly in memory or in a stack trace.
+		*(uintptr*)(s->start<<PageShift) = (uintptr)0xbeadbeadbeadbeadULL;
+	}
+	s->npreleased -= released;
+
+	if(s->npages > npage) {
+		// Carve the span from the front of s and put the rest
+		// back in the heap.  The rest keeps the MSpan structure,
+		// whose index entries already cover it, and its age.
+		t = runtime·SlabAlloc_Alloc(&h->spanalloc);
+		mstats.mspan_inuse = h->spanalloc.inuse;
+		mstats.mspan_sys = h->spanalloc.sys;
+		runtime·MSpan_Init(t, s->start, npage);
+		s->start += npage;
+		s->npages -= npage;
+		*(uintptr*)(s->start<<PageShift) = *(uintptr*)(t->start<<PageShift);  // copy "needs zeroing" mark
+		mstats.heap_idle += s->npages<<PageShift;
+		MHeap_InsertFree(h, s);
+		s = t;
+	}
+	s->state = MSpanInUse;
+	s->unusedsince = 0;
+
+	// Record span info, because gc needs to be
+	// able to map interior pointer to containing span.
+	sizeclass = SpanClass_SizeClass(spanclass);
+	s->sizeclass = sizeclass;
+	s->spanclass = spanclass;
+	s->elemsize = (sizeclass==0 ? s->npages<<PageShift : runtime·class_to_size[sizeclass]);
+	s->divmul = runtime·class_to_divmul[sizeclass];
+	s->types.compression = MTypes_Empty;
+	for(n=0; n<npage; n++)
+		setspan(h, s->start+n, s);
+	return s;
+}
+
+// Trim in-use span s to npage pages and put the rest back
+// in the heap, npreleased of them still released.
+static void
+MHeap_TrimLocked(MHeap *h, MSpan *s, uintptr npage, uintptr npreleased)
+{
+	PageID start;
+	uintptr n;
+
+	start = s->start + npage;
+	n = s->npages - npage;
+	s->npages = npage;
+	*(uintptr*)(start<<PageShift) = *(uintptr*)(s->start<<PageShift);  // copy "needs zeroing" mark
+	MHeap_FreePagesLocked(h, start, n, npreleased);
+}
+
+// Put pages [start, start+npage), just cut from an in-use span,
+// back in the heap as a span of their own, npreleased of them
+// still released to the operating system.  The caller has set
+// the "needs zeroing" mark in the first page.
+static void
+MHeap_FreePagesLocked(MHeap *h, PageID start, uintptr npage, uintptr npreleased)
+{
+	MSpan *t;
+	uintptr n;
+
+	t = runtime·SlabAlloc_Alloc(&h->spanalloc);
+	mstats.mspan_inuse = h->spanalloc.inuse;
+	mstats.mspan_sys = h->spanalloc.sys;
+	runtime·MSpan_Init(t, start, npage);
+	for(n=0; n<npage; n++)
+		setspan(h, start+n, t);
+	t->state = MSpanInUse;
+	t->npreleased = npreleased;
+	MHeap_FreeLocked(h, t);
+}
+
+// Find the smallest free span that holds npage pages starting
+// on a huge page boundary, or nil if there is none.  Walks the
+// treap of large spans in order from the first one that is big
+// enough; any span of npage + HugePagePages - 1 pages fits, so
+// the walk ends there at the latest.
+static MSpan*
+MHeap_FindHuge(MHeap *h, uintptr npage)
+{
+	MSpan *s, *t;
+
+	for(s = MHeap_AllocLarge(h, npage); s != nil; ) {
+		if(ROUND(s->start, HugePagePages) + npage <= s->start + s->npages)
+			return s;
+		// Next span in (npages, start) order.
+		if(s->tright != nil) {
+			for(s = s->tright; s->tleft != nil; s = s->tleft)
+				;
+		} else {
+			do {
+				t = s;
+				s = s->tparent;
+			} while(s != nil && s->tright == t);
+		}
+	}
+	return nil;
+}
+
+// Allocate a large span of npage pages that starts on a huge page
+// boundary, so that it is spread over as few huge pages as possible.
+// Takes the smallest free span with an aligned fit if there is one;
+// otherwise takes enough extra pages to be sure of an aligned start.
+// Gives back the pages on either side.  Falls back to an unaligned
+// span if the extra pages are not to be had.
+static MSpan*
+MHeap_AllocHuge(MHeap *h, uintptr npage, int32 spanclass)
+{
+	MSpan *s;
+	uintptr pad, released, n;
+
+	if((s = MHeap_FindHuge(h, npage)) != nil) {
+		pad = ROUND(s->start, HugePagePages) - s->start;
+		s = MHeap_AllocSpanLocked(h, s, pad + npage, spanclass, &released);
+	} else {
+		s = MHeap_AllocLocked(h, npage + HugePagePages - 1, spanclass, &released);
+		if(s == nil)
+			return MHeap_AllocLocked(h, npage, spanclass, nil);
+	}
+
+	// The pages given back take their share of the released
+	// pages with them (see MHeap_AllocLocked).
+	pad = ROUND(s->start, HugePagePages) - s->start;
+	if(pad > 0) {
+		n = released * pad / s->npages;
+		released -= n;
+		*(uintptr*)((s->start+pad)<<PageShift) = *(uintptr*)(s->start<<PageShift);  // copy "needs zeroing" mark
+		s->start += pad;
+		s->npages -= pad;
+		MHeap_FreePagesLocked(h, s->start - pad, pad, n);
+	}
+	if(s->npages > npage)
+		MHeap_TrimLocked(h, s, npage, released * (s->npages - npage) / s->npages);
+	s->elemsize = npage<<PageShift;
+	return s;
+}
+
+// Find the smallest span of at least npage pages in the treap of
+// large spans.  If there are multiple smallest spans, take the one
+// with the earliest starting address.
+static MSpan*
+MHeap_AllocLarge(MHeap *h, uintptr npage)
+{
+	MSpan *s, *best;
+
+	// The leftmost span with npages >= npage
+	// is the first in (npages, start) order.
+	best = nil;
+	s = h->large;
+	while(s != nil) {
+		if(s->npages >= npage) {
+			best = s;
+			s = s->tleft;
+		} else
+			s = s->tright;
+	}
+	return best;
+}
+
+static bool
+treapless(MSpan *a, MSpan *b)
+{
+	return a->npages < b->npages || (a->npages == b->npages && a->start < b->start);
+}
+
+// Make new take old's place as a child of p (or as the root).
+static void
+treapreplace(MHeap *h, MSpan *p, MSpan *old, MSpan *new)
+{
+	if(p == nil)
+		h->large = new;
+	else if(p->tleft == old)
+		p->tleft = new;
+	else
+		p->tright = new;
+	if(new != nil)
+		new->tparent = p;
+}
+
+// Move x's right child up into x's place.
+static void
+treaprotateleft(MHeap *h, MSpan *x)
+{
+	MSpan *y;
+
+	y = x->tright;
+	treapreplace(h, x->tparent, x, y);
+	x->tright = y->tleft;
+	if(x->tright != nil)
+		x->tright->tparent = x;
+	y->tleft = x;
+	x->tparent = y;
+}
+
+// Move x's left child up into x's place.
+static void
+treaprotateright(MHeap *h, MSpan *x)
+{
+	MSpan *y;
+
+	y = x->tleft;
+	treapreplace(h, x->tparent, x, y);
+	x->tleft = y->tright;
+	if(x->tleft != nil)
+		x->tleft->tparent = x;
+	y->tright = x;
+	x->tparent = y;
+}
+
+static void
+treapinsert(MHeap *h, MSpan *s)
+{
+	MSpan *p, **link;
+
+	s->tleft = nil;
+	s->tright = nil;
+	s->tpriority = runtime·fastrand1();
+	p = nil;
+	link = &h->large;
+	while(*link != nil) {
+		p = *link;
+		link = treapless(s, p) ? &p->tleft : &p->tright;
+	}
+	*link = s;
+	s->tparent = p;
+
+	// Restore heap order.
+	while(s->tparent != nil && s->tparent->tpriority > s->tpriority) {
+		if(s->tparent->tleft == s)
+			treaprotateright(h, s->tparent);
+		else
+			treaprotateleft(h, s->tparent);
+	}
+}
+
+static void
+treapremove(MHeap *h, MSpan *s)
+{
+	// Rotate s down to a leaf, keeping heap order, and cut it off.
+	while(s->tleft != nil || s->tright != nil) {
+		if(s->tright == nil || (s->tleft != nil && s->tleft->tpriority < s->tright->tpriority))
+			treaprotateright(h, s);
+		else
+			treaprotateleft(h, s);
+	}
+	treapreplace(h, s->tparent, s, nil);
+	s->tparent = nil;
+}
+
+// In-order neighbours in the treap, for walking the large spans.
+static MSpan*
+treapfirst(MSpan *s)
+{
+	if(s != nil)
+		while(s->tleft != nil)
+			s = s->tleft;
+	return s;
+}
+
+static MSpan*
+treaplast(MSpan *s)
+{
+	if(s != nil)
+		while(s->tright != nil)
+			s = s->tright;
+	return s;
+}
+
+static MSpan*
+treapnext(MSpan *s)
+{
+	if(s->tright != nil)
+		return treapfirst(s->tright);
+	while(s->tparent != nil && s->tparent->tright == s)
+		s = s->tparent;
+	return s->tparent;
+}
+
+static MSpan*
+treapprev(MSpan *s)
+{
+	if(s->tleft != nil)
+		return treaplast(s->tleft);
+	while(s->tparent != nil && s->tparent->tleft == s)
+		s = s->tparent;
+	return s->tparent;
+}
+
+// Put free span s on the free list or in the treap, by its length.
+static void
+MHeap_InsertFree(MHeap *h, MSpan *s)
+{
+	if(s->npages < nelem(h->free))
+		runtime·MSpanList_Insert(&h->free[s->npages], s);
+	else
+		treapinsert(h, s);
+}
+
+// Take free span s off its free list or out of the treap.
+// s->npages must not have changed since MHeap_InsertFree.
+static void
+MHeap_RemoveFree(MHeap *h, MSpan *s)
+{
+	if(s->npages < nelem(h->free))
+		runtime·MSpanList_Remove(s);
+	else
+		treapremove(h, s);
+}
+
+enum
+{
+	HeapGrowFast = 100*1000*1000,	// ns between growths that double the step
+	HeapGrowSlow = 1000*1000*1000,	// ns between growths that halve it
+};
+
+// Adjust h->growchunk for a growth at time now.  A heap that
+// grows again soon after the last time takes twice as much
+// memory at once as then, and one that grows rarely half as
+// much, so that a fast-growing heap maps and indexes memory in
+// few large steps.  The step stays between HeapAllocChunk and
+// MaxHeapAllocChunk and under a quarter of the heap; pages it
+// takes early stay idle until used, and the scavenger releases
+// them like any others (and resets the step) if they are not.
+static void
+MHeap_PaceGrowth(MHeap *h, int64 now)
+{
+	uintptr bound;
+
+	if(h->lastgrow != 0) {
+		if(now - h->lastgrow < HeapGrowFast)
+			h->growchunk *= 2;
+		else if(now - h->lastgrow > HeapGrowSlow)
+			h->growchunk /= 2;
+	}
+	h->lastgrow = now;
+	bound = mstats.heap_sys/4 & ~((uintptr)HeapAllocChunk-1);
+	if(bound > MaxHeapAllocChunk)
+		bound = MaxHeapAllocChunk;
+	if(h->growchunk > bound)
+		h->growchunk = bound;
+	if(h->growchunk < HeapAllocChunk)
+		h->growchunk = HeapAllocChunk;
+	runtime·allocstats.heap_growchunk = h->growchunk;
+}
+
+// Try to add at least npage pages of memory to the heap,
+// returning whether it worked.
+static bool
+MHeap_Grow(MHeap *h, uintptr npage)
+{
+	uintptr ask, pad;
+	void *v;
+	int64 t0;
+
+	t0 = runtime·nanotime();
+	runtime·allocstats.heap_grow++;
+	MHeap_PaceGrowth(h, t0);
+	// Ask for a big chunk, to reduce the number of mappings
+	// the operating system needs to track; also amortizes
+	// the overhead of an operating system mapping.
+	// Allocate a multiple of 64kB (16 pages).
+	npage = (npage+15)&~15;
+	ask = npage<<PageShift;
+	if(ask < h->growchunk)
+		ask = h->growchunk;
+
+	v = runtime·MHeap_SysAlloc(h, ask);
+	if(v == nil) {
+		if(ask > (npage<<PageShift)) {
+			ask = npage<<PageShift;
+			v = runtime·MHeap_SysAlloc(h, ask);
+		}
+		if(v == nil) {
+			runtime·printf("runtime: out of memory: cannot allocate %D-byte block (%D in use)\n", (uint64)ask, mstats.heap_sys);
+			runtime·allocstats.heap_grow_ns += runtime·nanotime() - t0;
+			runtime·MCache_Latency(m->mcache, AllocTierGrow, t0);
+			return false;
+		}
+	}
+	if(runtime·hugepages) {
+		// End the chunk on a huge page boundary, so that this and
+		// every later chunk is made of whole huge pages.  Round
+		// from where the chunk landed: MHeap_SysAlloc may have
+		// started a new region for it.  Regions end on an arena
+		// boundary, so the rest fits in place.  (Chunks mapped
+		// before huge page mode was switched on may have left the
+		// end unaligned.)
+		pad = ROUND((uintptr)v + ask, HugePageSize) - ((uintptr)v + ask);
+		if(pad > 0 && (byte*)v + ask == h->arena_alloc && pad <= h->arena_end - h->arena_alloc) {
+			runtime·MHeap_SysAlloc(h, pad);
+			ask += pad;
+		}
+	}
+	mstats.heap_sys += ask;
+
+	// Create a fake "in use" span and free it, so that the
+	// right coalescing happens.  Fresh memory is zeroed, so the
+	// "needs zeroing" mark is clear.
+	MHeap_FreePagesLocked(h, (uintptr)v>>PageShift, ask>>PageShift, 0);
+	runtime·allocstats.heap_grow_ns += runtime·nanotime() - t0;
+	runtime·MCache_Latency(m->mcache, AllocTierGrow, t0);
+	return true;
+}
+
+// Look up the span at the given address.
+// Address is guaranteed to be in map
+// and is guaranteed to be start or end of span.
+MSpan*
+runtime·MHeap_Lookup(MHeap *h, void *v)
+{
+	return MHeap_Arena(h, v)->spans[((uintptr)v>>PageShift) & (PagesPerArena-1)];
+}
+
+// Look up the span at the given address.
+// Address is *not* guaranteed to be in map
+// and may be anywhere in the span.
+// Returns nil unless the span is allocated.
+MSpan*
+runtime·MHeap_LookupMaybe(MHeap *h, void *v)
+{
+	MHeapArena *ha;
+	MSpan *s;
+	PageID p;
+
+	ha = runtime·MHeap_ArenaOf(h, v);
+	if(ha == nil)
+		return nil;
+	p = (uintptr)v>>PageShift;
+	s = ha->spans[p & (PagesPerArena-1)];
+	if(s == nil || p < s->start || p - s->start >= s->npages)
+		return nil;
+	if(s->state != MSpanInUse)
+		return nil;
+	return s;
+}
+
+// Look up the arena holding v.
+// Returns nil if v is not in a heap arena.
+MHeapArena*
+runtime·MHeap_ArenaOf(MHeap *h, void *v)
+{
+	MHeapArena **l2;
+
+	if((byte*)v < h->arena_start || (byte*)v >= h->arena_used)
+		return nil;
+	l2 = h->arenas[ArenaL1(v)];
+	if(l2 == nil)
+		return nil;
+	return l2[ArenaL2(v)];
+}
+
+// Make the arena index cover [v, v+n), which the caller
+// has just mapped for the heap, allocating index blocks
+// and arena metadata as needed.
+void
+runtime·MHeap_MapArenas(MHeap *h, byte *v, uintptr n)
+{
+	uintptr a, i, narena;
+	MHeapArena **l2;
+
+	a = (uintptr)v & ~((uintptr)HeapArenaBytes-1);
+	narena = ((uintptr)v+n-1)/HeapArenaBytes - (uintptr)v/HeapArenaBytes + 1;
+	for(i=0; i<narena; i++, a+=HeapArenaBytes) {
+		l2 = h->arenas[ArenaL1(a)];
+		if(l2 == nil) {
+			l2 = runtime·SysAlloc((1<<ArenaL2Bits)*sizeof l2[0]);
+			if(l2 == nil)
+				runtime·throw("runtime: cannot allocate heap metadata");
+			h->arenas[ArenaL1(a)] = l2;
+		}
+		if(l2[ArenaL2(a)] == nil) {
+			l2[ArenaL2(a)] = runtime·SysAlloc(sizeof(MHeapArena));
+			if(l2[ArenaL2(a)] == nil)
+				runtime·throw("runtime: cannot allocate heap metadata");
+		}
+	}
+
+	if(h->arena_start == nil || v < h->arena_start)
+		h->arena_start = v;
+	if(v+n > h->arena_used)
+		h->arena_used = v+n;
+}
+
+// Free the span back into the heap.  If acct is set,
+// count it in mstats as a freed object.
+void
+runtime·MHeap_Free(MHeap *h, MSpan *s, int32 acct)
+{
+	runtime·lock(h);
+	runtime·purgecachedstats(m->mcache);
+	mstats.heap_inuse -= s->npages<<PageShift;
+	if(acct) {
+		mstats.heap_alloc -= s->npages<<PageShift;
+		mstats.heap_objects--;
+		mstats.nfree++;
+		mstats.alloc -= s->npages<<PageShift;
+	}
+	MHeap_FreeLocked(h, s);
+	runtime·unlock(h);
+}
+
+// Free the spans on list, linked through next and ending in nil,
+// as MHeap_Free does, locking the heap once for all of them.
+void
+runtime·MHeap_FreeList(MHeap *h, MSpan *list, int32 acct)
+{
+	MSpan *s;
+
+	runtime·lock(h);
+	runtime·purgecachedstats(m->mcache);
+	while((s = list) != nil) {
+		list = s->next;
+		s->next = nil;
+		mstats.heap_inuse -= s->npages<<PageShift;
+		if(acct) {
+			mstats.heap_alloc -= s->npages<<PageShift;
+			mstats.heap_objects--;
+			mstats.nfree++;
+			mstats.alloc -= s->npages<<PageShift;
+		}
+		MHeap_FreeLocked(h, s);
+	}
+	runtime·unlock(h);
+}
+
+// Grow large-object span s to npage pages in place by taking the
+// free pages just after it, and count the extra pages in mstats as
+// allocated.  Returns false, leaving s alone, if those pages are
+// not free or not enough.  If zeroed is set, the new pages are
+// zeroed.
+bool
+runtime·MHeap_Extend(MHeap *h, MSpan *s, uintptr npage, int32 zeroed)
+{
+	MSpan *t;
+	PageID start;
+	uintptr n, extra, released;
+	bool needzero;
+
+	if(s->state != MSpanInUse || s->sizeclass != 0)
+		runtime·throw("MHeap_Extend - bad span");
+	if(npage <= s->npages)
+		return true;
+	extra = npage - s->npages;
+	start = s->start + s->npages;
+
+	runtime·lock(h);
+	t = spanof(h, start);
+	if(t == nil || t->state != MSpanFree || t->start != start || t->npages < extra) {
+		runtime·unlock(h);
+		return false;
+	}
+	runtime·purgecachedstats(m->mcache);
+	MHeap_RemoveFree(h, t);
+	mstats.heap_idle -= t->npages<<PageShift;
+	// Released pages may come back with old data; see MHeap_AllocLocked.
+	needzero = *(uintptr*)(start<<PageShift) != 0 || t->npreleased > 0;
+	if(t->npreleased > 0 && runtime·hugepages)
+		runtime·SysUsed((void*)(start<<PageShift), extra<<PageShift);
+	// t does not record where its released pages are, so charge
+	// the pages taken with their share of them and leave the
+	// rest, still released, with what remains of t.
+	released = t->npreleased;
+	if(t->npages > extra)
+		released = t->npreleased * extra / t->npages;
+	mstats.heap_released -= released<<PageShift;
+	t->npreleased -= released;
+	if(t->npages > extra) {
+		// Leave the rest of t in the heap.
+		t->start += extra;
+		t->npages -= extra;
+		if(needzero)
+			*(uintptr*)(t->start<<PageShift) = 1;	// mark as "needs to be zeroed"
+		mstats.heap_idle += t->npages<<PageShift;
+		MHeap_InsertFree(h, t);
+	} else {
+		t->state = MSpanDead;
+		runtime·SlabAlloc_Free(&h->spanalloc, t);
+		mstats.mspan_inuse = h->spanalloc.inuse;
+		mstats.mspan_sys = h->spanalloc.sys;
+	}
+	for(n=0; n<extra; n++)
+		setspan(h, start+n, s);
+	s->npages = npage;
+	s->elemsize = npage<<PageShift;
+	mstats.heap_inuse += extra<<PageShift;
+	mstats.heap_alloc += extra<<PageShift;
+	mstats.alloc += extra<<PageShift;
+	mstats.total_alloc += extra<<PageShift;
+	runtime·unlock(h);
+
+	if(needzero && zeroed)
+		runtime·memclr((byte*)(start<<PageShift), extra<<PageShift);
+	return true;
+}
+
+// Refill an MCache page cache: give back old, what is left of the
+// previous chunk (nil if none), take a new chunk of npage pages,
+// and top up the unused MSpan structures in spans[*nspans:max],
+// all in one acquisition of the heap lock.
+// Returns the new chunk, or nil if out of memory.
+MSpan*
+runtime·MHeap_RefillPageCache(MHeap *h, MSpan *old, uintptr npage, MSpan **spans, uint32 *nspans, uint32 max)
+{
+	MSpan *s;
+	int64 t0;
+
+	t0 = runtime·nanotime();
+	runtime·lock(h);
+	runtime·purgecachedstats(m->mcache);
+	if(old != nil) {
+		mstats.heap_inuse -= old->npages<<PageShift;
+		MHeap_FreeLocked(h, old);
+	}
+	s = MHeap_AllocLocked(h, npage, 0, nil);
+	if(s != nil) {
+		mstats.heap_inuse += npage<<PageShift;
+		while(*nspans < max) {
+			// Not a span until it is carved from the chunk;
+			// the sweeper skips dead spans in h->allspans.
+			spans[*nspans] = runtime·SlabAlloc_Alloc(&h->spanalloc);
+			spans[*nspans]->state = MSpanDead;
+			(*nspans)++;
+		}
+		mstats.mspan_inuse = h->spanalloc.inuse;
+		mstats.mspan_sys = h->spanalloc.sys;
+	}
+	runtime·unlock(h);
+	runtime·MCache_Latency(m->mcache, AllocTierHeap, t0);
+	return s;
+}
+
+// Give back an MCache page cache: the rest of its chunk
+// (nil if none) and its unused MSpan structures.
+void
+runtime·MHeap_FreePageCache(MHeap *h, MSpan *chunk, MSpan **spans, uint32 nspans)
+{
+	runtime·lock(h);
+	runtime·purgecachedstats(m->mcache);
+	if(chunk != nil) {
+		mstats.heap_inuse -= chunk->npages<<PageShift;
+		MHeap_FreeLocked(h, chunk);
+	}
+	while(nspans > 0)
+		runtime·SlabAlloc_Free(&h->spanalloc, spans[--nspans]);
+	mstats.mspan_inuse = h->spanalloc.inuse;
+	mstats.mspan_sys = h->spanalloc.sys;
+	runtime·unlock(h);
+}
+
+// Move the first npage pages of chunk into s, an unused MSpan,
+// as a large-object span.  chunk must be in use and owned by the
+// caller.  Does not lock the heap: the pages stay in use throughout,
+// and s is initialized before any index entry points at it, so a
+// concurrent MHeap_FreeLocked looking at a neighbouring page sees
+// an in-use span either way.
+void
+runtime·MHeap_SplitSpan(MHeap *h, MSpan *chunk, MSpan *s, uintptr npage)
+{
+	uintptr n;
+
+	if(chunk->state != MSpanInUse || chunk->npages <= npage)
+		runtime·throw("MHeap_SplitSpan - bad chunk");
+	runtime·MSpan_Init(s, chunk->start, npage);
+	s->state = MSpanInUse;
+	s->elemsize = npage<<PageShift;
+	for(n=0; n<npage; n++)
+		setspan(h, s->start+n, s);
+	chunk->start += npage;
+	chunk->npages -= npage;
+	chunk->elemsize = chunk->npages<<PageShift;
+}
+
+static void
+MHeap_FreeLocked(MHeap *h, MSpan *s)
+{
+	MSpan *t;
+
+	if(s->types.sysalloc)
+		runtime·settype_sysfree(s);
+	s->types.compression = MTypes_Empty;
+
+	if(s->state != MSpanInUse || s->ref != 0) {
+		runtime·printf("MHeap_FreeLocked - span %p ptr %p state %d ref %d\n", s, s->start<<PageShift, s->state, s->ref);
+		runtime·throw("MHeap_FreeLocked - invalid free");
+	}
+	mstats.heap_idle += s->npages<<PageShift;
+	s->state = MSpanFree;
+	runtime·MSpanList_Remove(s);
+	// Stamp newly unused spans. The scavenger will use that
+	// info to potentially give back some pages to the OS.
+	s->unusedsince = runtime·nanotime();
+	// An in-use span has no released pages, except for pages cut
+	// from a newly allocated one (see MHeap_FreePagesLocked).
+	mstats.heap_released += s->npreleased<<PageShift;
+
+	// Coalesce with earlier, later spans.
+	// Spans in separate regions of address space never
+	// coalesce: the page next to the region is in no arena.
+	if((t = spanof(h, s->start-1)) != nil && t->state != MSpanInUse)
+		s = MHeap_Coalesce(h, s, t);
+	if((t = spanof(h, s->start+s->npages)) != nil && t->state != MSpanInUse)
+		s = MHeap_Coalesce(h, s, t);
+
+	MHeap_InsertFree(h, s);
+}
+
+// Merge free span s with t, the free span next to it on either
+// side, and take t out of the free lists.  The merged span keeps the
+// MSpan structure of the longer of the two, so that only the index
+// entries of the shorter one need rewriting; the other structure goes
+// back to spanalloc.  Returns the merged span.
+static MSpan*
+MHeap_Coalesce(MHeap *h, MSpan *s, MSpan *t)
+{
+	MSpan *big, *small;
+	PageID start;
+	uintptr n, npages, npreleased;
+
+	MHeap_RemoveFree(h, t);
+	if(t->start < s->start) {
+		*(uintptr*)(t->start<<PageShift) |= *(uintptr*)(s->start<<PageShift);	// propagate "needs zeroing" mark
+		start = t->start;
+	} else {
+		*(uintptr*)(s->start<<PageShift) |= *(uintptr*)(t->start<<PageShift);	// propagate "needs zeroing" mark
+		start = s->start;
+	}
+	npages = s->npages + t->npages;
+	npreleased = s->npreleased + t->npreleased;	// absorb released pages
+
+	big = s;
+	small = t;
+	if(t->npages > s->npages) {
+		big = t;
+		small = s;
+	}
+	for(n=0; n<small->npages; n++)
+		setspan(h, small->start+n, big);
+	big->unusedsince = s->unusedsince;
+	big->start = start;
+	big->npages = npages;
+	big->npreleased = npreleased;
+	big->state = MSpanFree;
+	small->state = MSpanDead;
+	runtime·SlabAlloc_Free(&h->spanalloc, small);
+	mstats.mspan_inuse = h->spanalloc.inuse;
+	mstats.mspan_sys = h->spanalloc.sys;
+	return big;
+}
+
+// The scavenger keeps the memory the heap retains from the
+// operating system (heap_sys - heap_released) near a goal.
+// It starts releasing idle pages once retained memory is more
+// than goal/16 above the goal and keeps going, ScavengeStep
+// bytes at a time, until it is back at or below the goal.
+// The gap between the two thresholds stops it from releasing
+// pages that the very next allocation would fault back in.
+//
+// The goal is $GOSCVGGOAL megabytes if set, otherwise the
+// next GC target plus 10%, capped by the soft memory limit.  Independently of the goal, a span
+// left unused for ScavengeAge is released anyway.
+enum
+{
+	ScavengeStep = 4<<20,	// bytes released per step when over the goal
+};
+
+static uint64 scvggoal;	// from $GOSCVGGOAL; 0 means follow next_gc
+static int32 scvgtrace;
+
+static void
+forcegchelper(Note *note)
+{
+	runtime·gc(1);
+	runtime·notewakeup(note);
+}
+
+// Release the pages of free span s that are still backed by memory.
+// Returns the number of bytes released.
+static uintptr
+scavengespan(MSpan *s)
+{
+	uintptr released;
+	PageID start, end;
+
+	start = s->start;
+	end = s->start + s->npages;
+	if(runtime·hugepages) {
+		// Release only the whole huge pages in s.  The pages
+		// around it are likely in use, and releasing part of a
+		// huge page would split it into small pages for good.
+		start = ROUND(start, HugePagePages);
+		end &= ~(PageID)(HugePagePages-1);
+		if(end <= start)
+			return 0;
+	}
+	if(s->npreleased >= end - start)
+		return 0;
+	released = ((end - start) - s->npreleased) << PageShift;
+	mstats.heap_released += released;
+	s->npreleased = end - start;
+	runtime·SysUnused((void*)(start << PageShift), (end - start) << PageShift);
+	return released;
+}
+
+// Switch the heap to huge page mode.  The environment is only read
+// after mallocinit has mapped the first chunks of the heap, so ask
+// for huge pages in the arenas mapped so far as well.  Free spans
+// with released pages are left alone, or the kernel would back
+// them again; MHeap_AllocLocked advises them when they are reused.
+static void
+MHeap_EnableHugePages(MHeap *h)
+{
+	uintptr i, j;
+	byte *p, *end, *run, *next;
+	MSpan *s;
+
+	runtime·lock(h);
+	runtime·hugepages = 1;
+	for(i=0; i<nelem(h->arenas); i++) {
+		if(h->arenas[i] == nil)
+			continue;
+		for(j=0; j<(1<<ArenaL2Bits); j++) {
+			if(h->arenas[i][j] == nil)
+				continue;
+			p = (byte*)(((i<<ArenaL2Bits) | j) << HeapArenaShift);
+			end = p + HeapArenaBytes;
+			if(end > h->arena_used)
+				end = h->arena_used;
+			// Advise each run of spans between released ones.
+			// Pages with no span are not mapped.
+			for(run = p; p < end; p = next) {
+				s = spanof(h, (uintptr)p>>PageShift);
+				if(s == nil)
+					next = p + PageSize;
+				else
+					next = (byte*)((s->start + s->npages)<<PageShift);
+				if(s == nil || (s->state == MSpanFree && s->npreleased > 0)) {
+					if(run < p)
+						runtime·SysUsed(run, p - run);
+					run = next;
+				}
+			}
+			if(run < end)
+				runtime·SysUsed(run, end - run);
+		}
+	}
+	runtime·unlock(h);
+}
+
+static uintptr
+scavengelist(MSpan *list, uint64 now, uint64 limit)
+{
+	uintptr sumreleased;
+	MSpan *s;
+
+	if(runtime·MSpanList_IsEmpty(list))
+		return 0;
+
+	sumreleased = 0;
+	for(s=list->next; s != list; s=s->next) {
+		if((now - s->unusedsince) > limit)
+			sumreleased += scavengespan(s);
+	}
+	return sumreleased;
+}
+
+// Release spans that have been unused for longer than limit.
+static uintptr
+scavenge(uint64 now, uint64 limit)
+{
+	uint32 i;
+	uintptr sumreleased;
+	MHeap *h;
+	MSpan *s;
+
+	h = runtime·mheap;
+	sumreleased = 0;
+	for(i=0; i < nelem(h->free); i++)
+		sumreleased += scavengelist(&h->free[i], now, limit);
+	for(s=treapfirst(h->large); s != nil; s=treapnext(s)) {
+		if((now - s->unusedsince) > limit)
+			sumreleased += scavengespan(s);
+	}
+
+	// Give back the slabs of MSpan and MCache structures
+	// that are no longer used, keeping one of each for reuse.
+	runtime·SlabAlloc_Release(&h->spanalloc, 1);
+	runtime·SlabAlloc_Release(&h->cachealloc, 1);
+	mstats.mspan_inuse = h->spanalloc.inuse;
+	mstats.mspan_sys = h->spanalloc.sys;
+	mstats.mcache_inuse = h->cachealloc.inuse;
+	mstats.mcache_sys = h->cachealloc.sys;
+	return sumreleased;
+}
+
+// Release at least nbytes (if there is that much) from the free spans,
+// largest spans first: they are the least likely to be reused soon and
+// cost the fewest madvise calls per byte.
+static uintptr
+scavengelargest(MHeap *h, uintptr nbytes)
+{
+	uintptr sumreleased;
+	int32 i;
+	MSpan *list, *s;
+
+	sumreleased = 0;
+	for(s=treaplast(h->large); s != nil && sumreleased < nbytes; s=treapprev(s))
+		sumreleased += scavengespan(s);
+	for(i=nelem(h->free)-1; i > 0 && sumreleased < nbytes; i--) {
+		list = &h->free[i];
+		for(s=list->next; s != list && sumreleased < nbytes; s=s->next)
+			sumreleased += scavengespan(s);
+	}
+	return sumreleased;
+}
+
+// Memory the heap should retain from the operating system.
+// Under a soft memory limit, no more than fits in it beside the
+// runtime's other memory, unless the next gc target is higher.
+static uint64
+scavengegoal(void)
+{
+	uint64 goal, other;
+
+	if(scvggoal != 0)
+		return scvggoal;
+	goal = mstats.next_gc + mstats.next_gc/10;
+	if(runtime·gcmemlimit >= 0) {
+		other = runtime·nonheapsys();
+		if((uint64)runtime·gcmemlimit > other && goal > runtime·gcmemlimit - other)
+			goal = runtime·gcmemlimit - other;
+		if(goal < mstats.next_gc)
+			goal = mstats.next_gc;
+	}
+	return goal;
+}
+
+static void
+scavengetrace(int32 k)
+{
+	runtime·printf("scvg%d: inuse: %D, idle: %D, sys: %D, released: %D, consumed: %D, goal: %D (MB)\n",
+		k, mstats.heap_inuse>>20, mstats.heap_idle>>20, mstats.heap_sys>>20,
+		mstats.heap_released>>20, (mstats.heap_sys - mstats.heap_released)>>20,
+		scavengegoal()>>20);
+}
+
+// Release (part of) unused memory to OS.
+// Goroutine created at startup.
+// Loop forever.
+void
+runtime·MHeap_Scavenger(void)
+{
+	MHeap *h;
+	uint64 poll, now, lastage, lasttrim, forcegc, limit, trim, goal, retained, excess;
+	uintptr released, sumreleased;
+	uint32 k;
+	bool active;
+	byte *env;
+	Note note, *notep;
+
+	env = runtime·getenv("GOGCTRACE");
+	if(env != nil)
+		scvgtrace = runtime·atoi(env) > 0;
+	env = runtime·getenv("GOSCVGGOAL");
+	if(env != nil)
+		scvggoal = (uint64)runtime·atoi(env) << 20;
+	env = runtime·getenv("GOHUGEPAGES");
+	if(env != nil && runtime·atoi(env) > 0)
+		MHeap_EnableHugePages(runtime·mheap);
+	env = runtime·getenv("GOSCVGMADV");
+	if(env != nil) {
+		if(runtime·strcmp(env, (byte*)"free") == 0)
+			runtime·sysunusedlazy = 1;
+		else if(runtime·strcmp(env, (byte*)"dontneed") == 0)
+			runtime·sysunusedlazy = 0;
+	}
+
+	// If we go two minutes without a garbage collection, force one to run.
+	forcegc = 2*60*1e9;
+	// If a span goes unused for 5 minutes after a garbage collection,
+	// we hand it back to the operating system.
+	limit = 5*60*1e9;
+	// Check the goal once a second; while over it,
+	// release a step every 10ms so as not to hog the heap lock.
+	poll = 1e9;
+	// Trim idle MCaches every 10 seconds, every 2 while over the goal.
+	trim = 10*1e9;
+
+	h = runtime·mheap;
+	active = false;
+	sumreleased = 0;
+	lastage = runtime·nanotime();
+	lasttrim = lastage;
+	for(k=0;; k++) {
+		runtime·noteclear(&note);
+		runtime·entersyscallblock();
+		runtime·notetsleep(&note, active ? 10*1000*1000 : poll);
+		runtime·exitsyscall();
+
+		runtime·lock(h);
+		now = runtime·nanotime();
+		if(now - mstats.last_gc > forcegc) {
+			runtime·unlock(h);
+			// The scavenger can not block other goroutines,
+			// otherwise deadlock detector can fire spuriously.
+			// GC blocks other goroutines via the runtime·worldsema.
+			runtime·noteclear(&note);
+			notep = &note;
+			runtime·newproc1((byte*)forcegchelper, (byte*)&notep, sizeof(notep), 0, runtime·MHeap_Scavenger);
+			runtime·entersyscallblock();
+			runtime·notesleep(&note);
+			runtime·exitsyscall();
+			if(scvgtrace)
+				runtime·printf("scvg%d: GC forced\n", k);
+			runtime·lock(h);
+			now = runtime·nanotime();
+		}
+
+		goal = scavengegoal();
+		retained = mstats.heap_sys - mstats.heap_released;
+		if(!active && retained > goal + goal/16) {
+			active = true;
+			// The heap holds more than it needs;
+			// grow it in small steps again.
+			h->growchunk = HeapAllocChunk;
+			runtime·allocstats.heap_growchunk = h->growchunk;
+		}
+
+		if(now - lasttrim > (active ? trim/5 : trim)) {
+			// Each M trims its own cache the next time it
+			// allocates (see MCache_Trim).  Only the scavenger
+			// writes trimgen.
+			runtime·atomicstore(&runtime·trimgen, ((runtime·trimgen+2) & ~1) | active);
+			if(scvgtrace)
+				runtime·printf("scvg%d: MCache trim requested%s\n", k, active ? " under pressure" : "");
+			lasttrim = now;
+		}
+		if(active) {
+			excess = retained > goal ? retained - goal : 0;
+			if(excess > ScavengeStep)
+				excess = ScavengeStep;
+			released = 0;
+			if(excess > 0)
+				released = scavengelargest(h, excess);
+			sumreleased += released;
+			if(released == 0 || retained - released <= goal) {
+				active = false;
+				if(scvgtrace) {
+					runtime·printf("scvg%d: %D MB released to meet goal\n", k, (uint64)sumreleased>>20);
+					scavengetrace(k);
+				}
+				sumreleased = 0;
+			}
+		}
+
+		if(now - lastage > forcegc/2) {
+			lastage = now;
+			released = scavenge(now, limit);
+			if(scvgtrace) {
+				if(released > 0)
+					runtime·printf("scvg%d: %D MB released\n", k, (uint64)released>>20);
+				scavengetrace(k);
+			}
+		}
+		runtime·unlock(h);
+	}
+}
+
+void
+runtime∕debug·freeOSMemory(void)
+{
+	runtime·gc(1);
+	runtime·lock(runtime·mheap);
+	scavenge(~(uintptr)0, 0);
+	runtime·unlock(runtime·mheap);
+}
+
+// Initialize a new span with the given start and npages.
+void
+runtime·MSpan_Init(MSpan *span, PageID start, uintptr npages)
+{
+	span->next = nil;
+	span->prev = nil;
+	span->tleft = nil;
+	span->tright = nil;
+	span->tparent = nil;
+	span->start = start;
+	span->npages = npages;
+	span->ref = 0;
+	span->sizeclass = 0;
+	span->spanclass = 0;
+	span->elemsize = 0;
+	span->divmul = 0;
+	span->state = 0;
+	span->unusedsince = 0;
+	span->npreleased = 0;
+	span->types.compression = MTypes_Empty;
+	span->freeindex = 0;
+	span->nelems = 0;
+	span->alloccache = 0;
+	span->needzero = 0;
+	span->incache = 0;
+	span->allocidx = 0;
+}
+
+// Initialize an empty doubly-linked list.
+void
+runtime·MSpanList_Init(MSpan *list)
+{
+	list->state = MSpanListHead;
+	list->next = list;
+	list->prev = list;
+}
+
+void
+runtime·MSpanList_Remove(MSpan *span)
+{
+	if(span->prev == nil && span->next == nil)
+		return;
+	span->prev->next = span->next;
+	span->next->prev = span->prev;
+	span->prev = nil;
+	span->next = nil;
+}
+
+bool
+runtime·MSpanList_IsEmpty(MSpan *list)
+{
+	return list->next == list;
+}
+
+void
+runtime·MSpanList_Insert(MSpan *list, MSpan *span)
+{
+	if(span->next != nil || span->prev != nil) {
+		runtime·printf("failed MSpanList_Insert %p %p %p\n", span, span->next, span->prev);
+		runtime·throw("MSpanList_Insert");
+	}
+	span->next = list->next;
+	span->prev = list;
+	span->next->prev = span;
+	span->prev->next = span;
+}
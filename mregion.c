@@ -0,0 +1,137 @@
+// Copyright 2013 The Go Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Regions: objects that die together.
+//
+// See malloc.h for an overview.
+//
+// A Region hands out objects from chunks of RegionChunkSize bytes
+// with a bump pointer, and RegionFree gives back all of its chunks
+// to the heap under one acquisition of the heap lock.  The objects
+// cost no heap bitmap mark, sweep visit or free list insert of
+// their own: each chunk is a single large object to mallocgc, the
+// collector and the sweeper.
+//
+// The collector scans chunks conservatively, so objects in a region
+// may point anywhere in the heap, and a pointer into any object keeps
+// its whole chunk alive.  Each chunk starts with a pointer to the
+// previous one, so the Region itself, which points at the current
+// chunk, keeps all of them alive until RegionFree.  Objects too big
+// to be worth bump-allocating get a chunk of their own, linked in
+// behind the current one.
+//
+// Pointers into a region must not be used after RegionFree, just as
+// with runtime·free.
+
+#include "runtime.h"
+#include "arch_GOARCH.h"
+#include "malloc.h"
+
+typedef struct RegionChunk RegionChunk;
+struct RegionChunk
+{
+	RegionChunk	*prev;
+};
+
+enum
+{
+	RegionHeader = ROUND(sizeof(RegionChunk), 8),
+};
+
+// Allocate a new, empty region.
+Region*
+runtime·RegionNew(void)
+{
+	return runtime·mallocgc(sizeof(Region), FlagNoProfiling|FlagNoTiny, 1, 1);
+}
+
+// Allocate a chunk able to hold size bytes of objects.
+// FlagAlignPage makes it a span of its own even if it is small.
+static RegionChunk*
+RegionGrow(Region *r, uintptr size)
+{
+	RegionChunk *c;
+
+	c = runtime·mallocgc(RegionHeader + size, FlagNoProfiling|FlagAlignPage, 1, 1);
+	r->nchunk++;
+	return c;
+}
+
+// Allocate size bytes from r, 8-byte aligned.
+// The memory is zeroed.
+void*
+runtime·RegionAlloc(Region *r, uintptr size)
+{
+	RegionChunk *c;
+	byte *v;
+
+	if(size == 0)
+		size = 1;
+	size = ROUND(size, 8);
+	if(size > (uintptr)(r->end - r->next)) {
+		if(size > (RegionChunkSize - RegionHeader)/4) {
+			// A chunk of its own, behind the current one,
+			// so that the rest of the current one stays in use.
+			c = RegionGrow(r, size);
+			if(r->chunk == nil) {
+				r->chunk = (byte*)c;
+				r->next = (byte*)c + RegionHeader + size;
+				r->end = r->next;
+			} else {
+				c->prev = ((RegionChunk*)r->chunk)->prev;
+				((RegionChunk*)r->chunk)->prev = c;
+			}
+			r->alloc += size;
+			return (byte*)c + RegionHeader;
+		}
+		c = RegionGrow(r, RegionChunkSize - RegionHeader);
+		c->prev = (RegionChunk*)r->chunk;
+		r->chunk = (byte*)c;
+		r->next = (byte*)c + RegionHeader;
+		r->end = (byte*)c + RegionChunkSize;
+	}
+	v = r->next;
+	r->next += size;
+	r->alloc += size;
+	return v;
+}
+
+// Free every object in r at once.  r is left empty and may be reused.
+void
+runtime·RegionFree(Region *r)
+{
+	RegionChunk *c, *prev;
+	MSpan *s, *list;
+
+	if(r->chunk == nil)
+		return;
+	if(m->mallocing)
+		runtime·throw("malloc/free - deadlock");
+	m->mallocing = 1;
+
+	// Clear each chunk's heap bitmap bits as runtime·free does
+	// for a large object, then free the spans together.
+	list = nil;
+	for(c = (RegionChunk*)r->chunk; c != nil; c = prev) {
+		prev = c->prev;
+		s = runtime·MHeap_Lookup(runtime·mheap, c);
+		if(s == nil || s->state != MSpanInUse || s->sizeclass != 0 || (byte*)c != (byte*)(s->start<<PageShift))
+			runtime·throw("RegionFree: bad chunk");
+		if(raceenabled)
+			runtime·racefree(c);
+		*(uintptr*)c = 1;	// mark as "needs to be zeroed"
+		runtime·markfreed(c, s->npages<<PageShift);
+		runtime·unmarkspan(c, 1<<PageShift);
+		s->next = list;
+		list = s;
+	}
+	runtime·MHeap_FreeList(runtime·mheap, list, 1);
+
+	r->chunk = nil;
+	r->next = nil;
+	r->end = nil;
+	r->nchunk = 0;
+	r->alloc = 0;
+	m->mallocing = 0;
+}
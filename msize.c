@@ -0,0 +1,134 @@
+// Copyright 2009 The Go Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Malloc small size classes.
+//
+// See malloc.h for overview.
+//
+// The size classes are chosen so that rounding an allocation
+// request up to the next size class wastes at most 12.5% (1.125x).
+//
+// Each size class has its own page count that gets allocated
+// and chopped up when new objects of the size class are needed.
+// That page count is chosen so that chopping up the run of
+// pages into objects of the given size wastes at most 12.5% (1.125x)
+// of the memory.  It is not necessary that the cutoff here be
+// the same as above.
+//
+// The two sources of waste multiply, so the worst possible case
+// for the above constraints would be that allocations of some
+// size might have a 26.6% (1.266x) overhead.
+// In practice, only one of the wastes comes into play for a
+// given size (sizes < 512 waste mainly on the round-up,
+// sizes > 512 waste mainly on the page chopping).
+//
+// TODO(rsc): Compute max waste for any given size.
+//
+// A table tuned to a workload (see msizetune.c) can replace the
+// default one at startup; LoadSizeClasses installs either.
+
+#include "runtime.h"
+#include "arch_GOARCH.h"
+#include "malloc.h"
+
+int32 runtime·class_to_size[NumSizeClasses];
+int32 runtime·class_to_allocnpages[NumSizeClasses];
+int32 runtime·class_to_transfercount[NumSizeClasses];
+
+// The SizeToClass lookup tables, filled in by LoadSizeClasses.
+// Small sizes are looked up in 8-byte steps, larger ones in
+// 128-byte steps:
+//	size_to_class8[i] = sizeclass for (i-1)*8 < size <= i*8
+//	size_to_class128[i] = sizeclass for 1024+(i-1)*128 < size <= 1024+i*128
+int32 runtime·size_to_class8[1024/8 + 1];
+int32 runtime·size_to_class128[(MaxSmallSize-1024)/128 + 1];
+
+int32
+runtime·SizeToClass(int32 size)
+{
+	if(size > MaxSmallSize)
+		runtime·throw("SizeToClass - invalid size");
+	if(size > 1024-8)
+		return runtime·size_to_class128[(size-1024+127) >> 7];
+	return runtime·size_to_class8[(size+7)>>3];
+}
+
+// Compute the default size classes into t.
+void
+runtime·DefaultSizeClasses(SizeClassTable *t)
+{
+	int32 align, sizeclass, size, n;
+	uintptr allocsize, npages;
+
+	// Choose the class sizes and the pages per span of each.
+	t->size[0] = 0;
+	t->npages[0] = 0;
+	t->transfer[0] = 0;
+	sizeclass = 1;	// 0 means no class
+	align = 8;
+	for(size = align; size <= MaxSmallSize; size += align) {
+		if((size&(size-1)) == 0) {	// bump alignment once in a while
+			if(size >= 2048)
+				align = 256;
+			else if(size >= 128)
+				align = size / 8;
+			else if(size >= 16)
+				align = 16;	// required for x86 SSE instructions, if we want to use them
+		}
+		if((align&(align-1)) != 0)
+			runtime·throw("InitSizes - bug");
+
+		// Make the allocnpages big enough that
+		// the leftover is less than 1/8 of the total,
+		// so wasted space is at most 12.5%.
+		allocsize = PageSize;
+		while(allocsize%size > allocsize/8)
+			allocsize += PageSize;
+		npages = allocsize >> PageShift;
+
+		// If the previous sizeclass chose the same
+		// allocation size and fit the same number of
+		// objects into the page, we might as well
+		// use just this size instead of having two
+		// different sizes.
+		if(sizeclass > 1
+		&& npages == t->npages[sizeclass-1]
+		&& allocsize/size == allocsize/t->size[sizeclass-1]) {
+			t->size[sizeclass-1] = size;
+			continue;
+		}
+
+		if(sizeclass >= NumSizeClasses)
+			runtime·throw("InitSizes - bad NumSizeClasses");
+		t->npages[sizeclass] = npages;
+		t->size[sizeclass] = size;
+		sizeclass++;
+	}
+	if(sizeclass != NumSizeClasses) {
+		runtime·printf("sizeclass=%d NumSizeClasses=%d\n", sizeclass, NumSizeClasses);
+		runtime·throw("InitSizes - bad NumSizeClasses");
+	}
+	t->nclass = sizeclass;
+
+	// Choose the number of objects to move at once
+	// between an MCache and the central lists.
+	for(sizeclass = 1; sizeclass < NumSizeClasses; sizeclass++) {
+		n = 64*1024 / t->size[sizeclass];
+		if(n < 2)
+			n = 2;
+		if(n > 32)
+			n = 32;
+		t->transfer[sizeclass] = n;
+	}
+}
+
+// Install the default size classes.
+void
+runtime·InitSizes(void)
+{
+	SizeClassTable t;
+
+	runtime·DefaultSizeClasses(&t);
+	runtime·LoadSizeClasses(&t);
+}
@@ -0,0 +1,254 @@
+// Copyright 2013 The Go Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Size classes tuned to a workload.
+//
+// See malloc.h for an overview.
+//
+// mallocgc counts the sizes of small allocations in a histogram with
+// one bucket per entry of SizeToClass's lookup tables: 8-byte steps
+// up to 1024 bytes and 128-byte steps above.  Those are the only
+// places a class boundary can fall.  GenSizeClasses finds the table
+// of NumSizeClasses classes that wastes the least memory on such a
+// histogram, counting both the rounding of each object up to its
+// class and each object's share of the unused tail of its span.
+// It uses dynamic programming over the class boundaries.
+//
+// runtime∕debug·writeSizeClasses prints such a table for the running
+// program as C source for runtime·sizeclasses, with the waste
+// expected of it and of the default table.  A runtime built with
+// that definition loads the table in mallocinit instead of the one
+// InitSizes computes.
+
+#include "runtime.h"
+#include "arch_GOARCH.h"
+#include "malloc.h"
+
+// The class table mallocinit loads; nclass == 0 means the default.
+// Replace with the output of writeSizeClasses to tune the runtime.
+SizeClassTable runtime·sizeclasses;
+
+// Small allocations by size (see SizeBucket), as of the last GC.
+uint64 runtime·sizehist[NumSizeBuckets];
+
+// Largest object size in histogram bucket b.
+static int32
+bucketsize(int32 b)
+{
+	if(b <= 1024/8)
+		return b*8;
+	return 1024 + (b - 1024/8)*128;
+}
+
+// Pages per span for objects of the given size, chosen as InitSizes
+// does: enough that the unused tail of a span is at most 1/8 of it.
+static int32
+classpages(int32 size)
+{
+	int32 allocsize;
+
+	allocsize = PageSize;
+	while(allocsize%size > allocsize/8)
+		allocsize += PageSize;
+	return allocsize >> PageShift;
+}
+
+// Fill in the pages and transfer count of each class of t from its size.
+static void
+fillclasses(SizeClassTable *t)
+{
+	int32 i, n;
+
+	t->npages[0] = 0;
+	t->transfer[0] = 0;
+	for(i=1; i<t->nclass; i++) {
+		t->npages[i] = classpages(t->size[i]);
+		n = 64*1024 / t->size[i];
+		if(n < 2)
+			n = 2;
+		if(n > 32)
+			n = 32;
+		t->transfer[i] = n;
+	}
+}
+
+// Bytes wasted by the objects of histogram buckets a through e
+// in a class the size of bucket e whose spans have npages pages.
+// H and HU are prefix sums of the counts and of count*size.
+static uint64
+segwaste(uint64 *H, uint64 *HU, int32 a, int32 e, int32 npages)
+{
+	uint64 n;
+	int32 size, alloc;
+
+	size = bucketsize(e);
+	alloc = npages << PageShift;
+	n = H[e] - H[a-1];
+	return n*size - (HU[e] - HU[a-1]) + n*(alloc%size)/(alloc/size);
+}
+
+// Set t to the table of NumSizeClasses classes that wastes the
+// least on histogram hist.  Classes 1 and 2 stay at 8 and TinySize
+// bytes, as the tiny allocator needs, and the last class is
+// MaxSmallSize bytes.
+void
+runtime·GenSizeClasses(uint64 *hist, SizeClassTable *t)
+{
+	enum { K = NumSizeClasses-1, N = NumSizeBuckets-1 };
+	uint64 *H, *HU, *f, best, w;
+	int16 *from;
+	int32 i, k, e, d, npages[N+1];
+	uintptr nbytes;
+
+	nbytes = 2*(N+1)*sizeof(uint64) + (K+1)*(N+1)*(sizeof(uint64)+sizeof(int16));
+	H = runtime·SysAlloc(nbytes);
+	if(H == nil)
+		runtime·throw("runtime: cannot allocate memory");
+	HU = H + (N+1);
+	f = HU + (N+1);
+	from = (int16*)(f + (K+1)*(N+1));
+
+	// SysAlloc memory is zeroed, so H[0] = HU[0] = 0.
+	for(e=1; e<=N; e++) {
+		H[e] = H[e-1] + hist[e];
+		HU[e] = HU[e-1] + hist[e]*bucketsize(e);
+		npages[e] = classpages(bucketsize(e));
+	}
+
+	// f[k*(N+1)+e] is the least waste of classes 1 through k
+	// with class k ending at bucket e, and from[] the bucket
+	// class k-1 then ends at.
+	for(i=0; i<(K+1)*(N+1); i++)
+		f[i] = ~(uint64)0;
+	f[2*(N+1)+2] = segwaste(H, HU, 1, 1, npages[1]) + segwaste(H, HU, 2, 2, npages[2]);
+	for(k=3; k<=K; k++) {
+		for(e=k; e<=N; e++) {
+			best = ~(uint64)0;
+			for(d=k-1; d<e; d++) {
+				if(f[(k-1)*(N+1)+d] == ~(uint64)0)
+					continue;
+				w = f[(k-1)*(N+1)+d] + segwaste(H, HU, d+1, e, npages[e]);
+				if(w < best) {
+					best = w;
+					from[k*(N+1)+e] = d;
+				}
+			}
+			f[k*(N+1)+e] = best;
+		}
+	}
+
+	t->nclass = NumSizeClasses;
+	t->size[0] = 0;
+	e = N;
+	for(k=K; k>=3; k--) {
+		t->size[k] = bucketsize(e);
+		e = from[k*(N+1)+e];
+	}
+	t->size[1] = 8;
+	t->size[2] = TinySize;
+	fillclasses(t);
+	runtime·SysFree(H, nbytes);
+}
+
+// Count the bytes histogram hist asks for and the bytes the
+// classes of t would waste on it.
+static void
+tablewaste(uint64 *hist, SizeClassTable *t, uint64 *need, uint64 *wasted)
+{
+	int32 b, c, size, alloc;
+
+	*need = 0;
+	*wasted = 0;
+	c = 1;
+	for(b=1; b<NumSizeBuckets; b++) {
+		size = bucketsize(b);
+		while(t->size[c] < size)
+			c++;
+		alloc = t->npages[c] << PageShift;
+		*need += hist[b]*size;
+		*wasted += hist[b]*(t->size[c] - size) + hist[b]*(alloc%t->size[c])/(alloc/t->size[c]);
+	}
+}
+
+// Check size class table t and make it the one in use.
+// Called by mallocinit before the first allocation.
+void
+runtime·LoadSizeClasses(SizeClassTable *t)
+{
+	int32 i, b, c;
+
+	if(t->nclass != NumSizeClasses)
+		runtime·throw("LoadSizeClasses: wrong number of classes");
+	if(t->size[1] != 8 || t->size[TinySizeClass] != TinySize || t->size[NumSizeClasses-1] != MaxSmallSize)
+		runtime·throw("LoadSizeClasses: bad fixed class");
+	for(i=1; i<NumSizeClasses; i++) {
+		if(t->size[i] <= t->size[i-1] || t->size[i]%8 != 0 || (t->size[i] > 1024 && t->size[i]%128 != 0))
+			runtime·throw("LoadSizeClasses: bad class size");
+		if(t->npages[i] <= 0 || (t->npages[i]<<PageShift)/t->size[i] > MaxSpanObjects)
+			runtime·throw("LoadSizeClasses: bad class pages");
+	}
+
+	for(i=0; i<NumSizeClasses; i++) {
+		runtime·class_to_size[i] = t->size[i];
+		runtime·class_to_allocnpages[i] = t->npages[i];
+		runtime·class_to_transfercount[i] = t->transfer[i];
+		mstats.by_size[i].size = t->size[i];
+	}
+	c = 1;
+	for(b=0; b<NumSizeBuckets; b++) {
+		while(t->size[c] < bucketsize(b))
+			c++;
+		// Sizes 1017 to 1024 are looked up in size_to_class128[0].
+		if(b <= 1024/8)
+			runtime·size_to_class8[b] = c;
+		if(b >= 1024/8)
+			runtime·size_to_class128[b - 1024/8] = c;
+	}
+}
+
+static void
+printrow(int32 *v)
+{
+	int32 i;
+
+	runtime·printf("\t{");
+	for(i=0; i<NumSizeClasses; i++) {
+		if(i%8 == 0)
+			runtime·printf("\n\t\t");
+		runtime·printf("%d,", v[i]);
+	}
+	runtime·printf("\n\t},\n");
+}
+
+// Print a size class table tuned for the small allocations made so
+// far (as of the last GC), as C source for runtime·sizeclasses, and
+// how much it and the default table would waste on them.
+void
+runtime∕debug·writeSizeClasses(void)
+{
+	SizeClassTable def, tuned;
+	uint64 need, defwaste, tunedwaste, n;
+	int32 b;
+
+	n = 0;
+	for(b=0; b<NumSizeBuckets; b++)
+		n += runtime·sizehist[b];
+	if(n == 0) {
+		runtime·printf("// no small allocations recorded yet\n");
+		return;
+	}
+	runtime·DefaultSizeClasses(&def);
+	runtime·GenSizeClasses(runtime·sizehist, &tuned);
+	tablewaste(runtime·sizehist, &def, &need, &defwaste);
+	tablewaste(runtime·sizehist, &tuned, &need, &tunedwaste);
+
+	runtime·printf("// %D small allocations of %D bytes (sizes rounded to 8 or 128 bytes).\n", n, need);
+	runtime·printf("// Default table wastes %D bytes, %D per 1000 requested.\n", defwaste, defwaste*1000/need);
+	runtime·printf("// This table wastes %D bytes, %D per 1000 requested.\n", tunedwaste, tunedwaste*1000/need);
+	runtime·printf("SizeClassTable runtime·sizeclasses = {\n\t%d,\n", tuned.nclass);
+	printrow(tuned.size);
+	printrow(tuned.npages);
+	printrow(tuned.transfer);
+	runtime·printf("};\n");
+}
@@ -0,0 +1,202 @@
+// Copyright 2009 The Go Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+// Slab allocator for the allocator's own fixed-size objects.
+//
+// See malloc.h for an overview.
+//
+// Objects are carved from slabs of SlabSize bytes obtained from the
+// operating system.  Each slab is aligned to SlabSize, so an object
+// finds its slab by masking its address.  A slab is on one of three
+// lists: partial (some objects free), full (none free) or empty (all
+// free).  Allocation prefers partial slabs, so that empty slabs tend
+// to stay empty; SlabAlloc_Release gives them back to the operating
+// system.
+
+#include "runtime.h"
+#include "arch_GOARCH.h"
+#include "malloc.h"
+
+// Offset of the first object in a slab.
+#define SlabHeader	ROUND(sizeof(Slab), CacheLineSize)
+
+static void
+SlabList_Init(Slab *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static void
+SlabList_Remove(Slab *s)
+{
+	s->prev->next = s->next;
+	s->next->prev = s->prev;
+	s->next = nil;
+	s->prev = nil;
+}
+
+static void
+SlabList_Insert(Slab *list, Slab *s)
+{
+	s->next = list->next;
+	s->prev = list;
+	s->next->prev = s;
+	s->prev->next = s;
+}
+
+// Initialize f to allocate objects of the given size.
+// first is called the first time an object is handed out,
+// release before the slab holding the objects in [lo, hi)
+// goes back to the operating system.
+void
+runtime·SlabAlloc_Init(SlabAlloc *f, uintptr size, void (*first)(void*, byte*), void (*release)(void*, byte*, byte*), void *arg)
+{
+	if(size < sizeof(MLink))
+		size = sizeof(MLink);
+	size = ROUND(size, sizeof(void*));
+	if(size > SlabSize - SlabHeader)
+		runtime·throw("SlabAlloc_Init: object larger than a slab");
+	f->size = size;
+	f->first = first;
+	f->release = release;
+	f->arg = arg;
+	SlabList_Init(&f->partial);
+	SlabList_Init(&f->full);
+	SlabList_Init(&f->empty);
+	f->nempty = 0;
+	f->inuse = 0;
+	f->sys = 0;
+}
+
+// Get a new slab from the operating system.
+// Maps twice the size to be sure of an aligned slab
+// and unmaps the rest.
+static Slab*
+SlabAlloc_Grow(SlabAlloc *f)
+{
+	byte *p, *q, *end;
+	Slab *s;
+
+	p = runtime·SysAlloc(2*SlabSize);
+	if(p == nil)
+		runtime·throw("out of memory (SlabAlloc)");
+	q = (byte*)ROUND((uintptr)p, SlabSize);
+	end = p + 2*SlabSize;
+	if(q > p)
+		runtime·SysFree(p, q - p);
+	if(q + SlabSize < end)
+		runtime·SysFree(q + SlabSize, end - (q + SlabSize));
+	f->sys += SlabSize;
+
+	s = (Slab*)q;
+	s->free = nil;
+	s->fresh = q + SlabHeader;
+	s->nobj = (SlabSize - SlabHeader) / f->size;
+	s->nfree = s->nobj;
+	return s;
+}
+
+// Take a free object from the slabs.  f must be locked.
+static void*
+SlabAlloc_Take(SlabAlloc *f)
+{
+	Slab *s;
+	MLink *v;
+
+	s = f->partial.next;
+	if(s == &f->partial) {
+		s = f->empty.next;
+		if(s != &f->empty) {
+			SlabList_Remove(s);
+			f->nempty--;
+		} else
+			s = SlabAlloc_Grow(f);
+		SlabList_Insert(&f->partial, s);
+	}
+	if(s->free != nil) {
+		v = s->free;
+		s->free = v->next;
+	} else {
+		v = (MLink*)s->fresh;
+		s->fresh += f->size;
+		if(f->first)
+			f->first(f->arg, (byte*)v);
+	}
+	if(--s->nfree == 0) {
+		SlabList_Remove(s);
+		SlabList_Insert(&f->full, s);
+	}
+	return v;
+}
+
+// Put object p back in its slab.  f must be locked.
+static void
+SlabAlloc_Put(SlabAlloc *f, void *p)
+{
+	Slab *s;
+	MLink *v;
+
+	s = (Slab*)((uintptr)p & ~(uintptr)(SlabSize-1));
+	v = p;
+	v->next = s->free;
+	s->free = v;
+	if(s->nfree++ == 0) {
+		SlabList_Remove(s);
+		SlabList_Insert(&f->partial, s);
+	}
+	if(s->nfree == s->nobj) {
+		SlabList_Remove(s);
+		SlabList_Insert(&f->empty, s);
+		f->nempty++;
+	}
+}
+
+// Allocate an object.  The memory is not zeroed.
+void*
+runtime·SlabAlloc_Alloc(SlabAlloc *f)
+{
+	void *v;
+
+	runtime·xadd64(&f->inuse, f->size);
+	runtime·lock(f);
+	v = SlabAlloc_Take(f);
+	runtime·unlock(f);
+	return v;
+}
+
+// Free an object.
+void
+runtime·SlabAlloc_Free(SlabAlloc *f, void *p)
+{
+	runtime·xadd64(&f->inuse, -(int64)f->size);
+	runtime·lock(f);
+	SlabAlloc_Put(f, p);
+	runtime·unlock(f);
+}
+
+// Give the empty slabs beyond the first keep back to the
+// operating system.  Returns the number of bytes released.
+uintptr
+runtime·SlabAlloc_Release(SlabAlloc *f, uint32 keep)
+{
+	Slab *s;
+	uintptr released;
+
+	released = 0;
+	runtime·lock(f);
+	while(f->nempty > keep) {
+		// The least recently emptied slab.
+		s = f->empty.prev;
+		SlabList_Remove(s);
+		f->nempty--;
+		if(f->release)
+			f->release(f->arg, (byte*)s + SlabHeader, s->fresh);
+		runtime·SysFree(s, SlabSize);
+		f->sys -= SlabSize;
+		released += SlabSize;
+	}
+	runtime·unlock(f);
+	return released;
+}